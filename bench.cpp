@@ -0,0 +1,203 @@
+#include "eval.hpp"
+#include "exprset.hpp"
+#include "jit.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long long> allocations{0};
+
+void* operator new(std::size_t size) {
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+
+struct Corpus {
+	std::string name;
+	std::vector<std::wstring> exprs;
+};
+
+struct Measurement {
+	double ns = 0;
+	double allocs = 0;
+};
+
+double minSeconds = 0.2;
+
+template <typename F>
+Measurement measure(int perIteration, F body) {
+	using Clock = std::chrono::steady_clock;
+	long long iterations = 0;
+	long long allocs = 0;
+	Clock::duration elapsed{};
+	long long batch = 1;
+	while (std::chrono::duration<double>(elapsed).count() < minSeconds) {
+		long long before = allocations.load(std::memory_order_relaxed);
+		Clock::time_point start = Clock::now();
+		for (long long i = 0; i < batch; i++) body();
+		elapsed += Clock::now() - start;
+		allocs += allocations.load(std::memory_order_relaxed) - before;
+		iterations += batch;
+		batch *= 2;
+	}
+	double count = static_cast<double>(iterations) * perIteration;
+	return { std::chrono::duration<double, std::nano>(elapsed).count() / count, allocs / count };
+}
+
+std::wstring chain(const wchar_t* op, int clauses) {
+	std::wstring result;
+	for (int i = 0; i < clauses; i++) {
+		if (i) result += std::wstring(L" ") + op + L" ";
+		result += L"x == " + std::to_wstring(i);
+	}
+	return result;
+}
+
+std::wstring nested(int depth) {
+	std::wstring result = L"x";
+	for (int i = 0; i < depth; i++) result = L"(" + result + (i % 2 ? L" * 2" : L" + y") + L")";
+	return result;
+}
+
+std::wstring concatenation(int fragments) {
+	std::wstring result = L"s";
+	for (int i = 0; i < fragments; i++) result += i % 2 ? L" + s" : L" + \"fragment " + std::to_wstring(i) + L"\"";
+	return result;
+}
+
+std::wstring mathHeavy(int terms) {
+	const wchar_t* parts[] = { L"sin(x)", L"cos(y)", L"pow(x, 2)", L"sqrt(abs(y))", L"tan(x / 4)", L"exp(-y)", L"log(abs(x) + 1)", L"max(x, y)" };
+	std::wstring result;
+	for (int i = 0; i < terms; i++) {
+		if (i) result += i % 3 ? L" + " : L" * ";
+		result += parts[i % 8];
+	}
+	return result;
+}
+
+std::vector<Corpus> buildCorpora() {
+	std::vector<Corpus> corpora;
+	corpora.push_back({ "readme", {
+		L"1 + 2", L"1.0 + 2.0", L"1 + 2 * 3", L"(1 + 2) * 3", L"1 + 2 == 3",
+		L"1 + 2 == 3 and 2 * 3 == 6", L"0 == 1 or 1 == 1", L"1 * 2 == 2 or 0 == 1 and 1 * 3 == 3 or 0 == 1",
+		L"1 == 1 and 2 == 2 and 3 != 3", L"\"Hello\" + \" \" + \"World!\"", L"true and false", L"-(1 + 2 * 3)",
+		L"not 1 == 1 or not 1 == 2", L"-cos(0) + sin(0) + tan(0)", L"sin 1", L"pow((1 * 4), 2) + 4",
+	} });
+	corpora.push_back({ "or-chain", { chain(L"or", 8), chain(L"or", 32), chain(L"or", 128) } });
+	corpora.push_back({ "and-chain", { chain(L"and", 8), chain(L"and", 32), chain(L"and", 128) } });
+	corpora.push_back({ "nested", { nested(8), nested(32), nested(128) } });
+	corpora.push_back({ "strings", { concatenation(4), concatenation(16), concatenation(64) } });
+	corpora.push_back({ "math", { mathHeavy(4), mathHeavy(16), mathHeavy(64) } });
+	return corpora;
+}
+
+Value bindingFor(const std::wstring& name) {
+	static const std::wstring text = L"text";
+	if (name == L"s") return Value::fromString(&text);
+	if (name == L"x") return Value::fromFloat(0.0);
+	return Value::fromFloat(1.5);
+}
+
+int main(int argc, char** argv) {
+	if (argc > 1) minSeconds = std::atof(argv[1]);
+	std::printf("%-10s %6s %12s %8s %12s %8s %12s %8s %14s %10s\n",
+		"corpus", "bytes", "tokenize ns", "allocs", "parse ns", "allocs", "run ns", "allocs", "run evals/s", "jit ns");
+	for (const Corpus& corpus : buildCorpora()) {
+		int count = corpus.exprs.size();
+		size_t bytes = 0;
+		std::vector<std::vector<TokenView>> tokens;
+		std::vector<CompiledExpr> compiled;
+		std::vector<std::vector<Value>> slots;
+		for (const std::wstring& src : corpus.exprs) {
+			bytes += src.size();
+			tokens.push_back(tokenize(src));
+			compiled.push_back(compile(src, tokens.back()));
+			std::vector<Value> row;
+			for (const std::wstring& name : compiled.back().variables) row.push_back(bindingFor(name));
+			slots.push_back(row);
+		}
+		Measurement lex = measure(count, [&] {
+			for (const std::wstring& src : corpus.exprs) tokenize(src);
+		});
+		Measurement parse = measure(count, [&] {
+			for (int i = 0; i < count; i++) compile(corpus.exprs[i], tokens[i]);
+		});
+		Measurement run = measure(count, [&] {
+			for (int i = 0; i < count; i++) compiled[i].run(slots[i]);
+		});
+		std::vector<std::unique_ptr<JitCode>> jitted;
+		for (const CompiledExpr& expr : compiled) {
+			if (auto code = jitCompile(expr)) jitted.push_back(std::move(code));
+		}
+		char jit[16] = "-";
+		if (jitted.size() == count) {
+			Measurement native = measure(count, [&] {
+				for (int i = 0; i < count; i++) jitted[i]->call(slots[i].data());
+			});
+			std::snprintf(jit, sizeof(jit), "%.1f", native.ns);
+		}
+		std::printf("%-10s %6zu %12.1f %8.2f %12.1f %8.2f %12.1f %8.2f %14.0f %10s\n",
+			corpus.name.c_str(), bytes / count, lex.ns, lex.allocs, parse.ns, parse.allocs, run.ns, run.allocs, 1e9 / run.ns, jit);
+	}
+
+	std::vector<std::wstring> rules;
+	for (int i = 0; i < 256; i++) {
+		rules.push_back(L"pow(x, 2) + sqrt(abs(y)) > " + std::to_wstring(i % 16) + L" and x < y or sin(x) * cos(y) > 0." + std::to_wstring(i % 10));
+	}
+	ExprSet set = compileSet(rules);
+	std::vector<CompiledExpr> separate;
+	for (const std::wstring& src : rules) separate.push_back(compile(src));
+	std::vector<Value> row;
+	for (const std::wstring& name : set.variables) row.push_back(bindingFor(name));
+	std::vector<Value> results(rules.size());
+	Measurement alone = measure(1, [&] {
+		std::forward_list<std::wstring> temps;
+		for (int i = 0; i < separate.size(); i++) results[i] = separate[i].execute(row.data(), temps);
+	});
+	Measurement shared = measure(1, [&] {
+		std::forward_list<std::wstring> temps;
+		set.execute(row.data(), results.data(), temps);
+	});
+	std::printf("\nrule set: %zu expressions, %zu of %d nodes after sharing, separate %.1f ns, shared %.1f ns per record\n",
+		rules.size(), set.nodes.size(), set.unsharedNodes, alone.ns, shared.ns);
+
+	// One field of a 64-field record changes per update; each rule reads two.
+	std::vector<std::wstring> fieldRules;
+	for (int i = 0; i < 256; i++) {
+		std::wstring a = L"f" + std::to_wstring(i % 64), b = L"f" + std::to_wstring(i * 7 % 64);
+		fieldRules.push_back(L"pow(" + a + L", 2) + sqrt(abs(" + b + L")) > " + std::to_wstring(i % 16) + L" and " + a + L" < " + b);
+	}
+	ExprSet fields = compileSet(fieldRules);
+	ReactiveSet live(compileSet(fieldRules));
+	std::vector<Value> record(fields.variables.size(), Value::fromFloat(1.5));
+	for (int slot = 0; slot < record.size(); slot++) live.set(slot, record[slot]);
+	std::vector<Value> fieldResults(fieldRules.size());
+	int update = 0;
+	Measurement full = measure(1, [&] {
+		update++;
+		record[update % record.size()] = Value::fromFloat(update % 7);
+		std::forward_list<std::wstring> temps;
+		fields.execute(record.data(), fieldResults.data(), temps);
+	});
+	uint64_t before = live.recomputed;
+	int updates = 0;
+	Measurement incremental = measure(1, [&] {
+		updates++;
+		live.set(updates % record.size(), Value::fromFloat(updates % 7));
+		for (int i = 0; i < fieldRules.size(); i++) fieldResults[i] = live.value(i);
+	});
+	std::printf("field updates: %zu nodes, full %.1f ns, incremental %.1f ns (%.1f nodes recomputed) per update\n",
+		fields.nodes.size(), full.ns, incremental.ns, double(live.recomputed - before) / updates);
+}
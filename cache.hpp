@@ -0,0 +1,154 @@
+#pragma once
+#include "eval.hpp"
+
+#include <functional>
+#include <list>
+
+inline bool isWordChar(wchar_t c) {
+	CharType type = getCharType(c);
+	return type == CharType::IdentifierAndKeyword || type == CharType::NumberLiteral || c == L'_' || c == L'.';
+}
+
+// Drops whitespace outside string literals unless it separates two words
+// ("not x") or would glue an operator onto a following '=' ("< =").
+inline void normalizeSource(std::wstring_view src, std::wstring& out) {
+	out.clear();
+	bool pendingSpace = false;
+	for (size_t i = 0; i < src.size(); i++) {
+		wchar_t c = src[i];
+		if (getCharType(c) == CharType::WhiteSpace) {
+			pendingSpace = !out.empty();
+			continue;
+		}
+		if (pendingSpace) {
+			wchar_t last = out.back();
+			if ((isWordChar(last) && isWordChar(c)) || (c == L'=' && (last == L'=' || last == L'!' || last == L'<' || last == L'>'))) {
+				out += L' ';
+			}
+			pendingSpace = false;
+		}
+		if (c == L'\"') {
+			size_t end = src.find(L'\"', i + 1);
+			if (end == std::wstring_view::npos) end = src.size() - 1;
+			out.append(src.substr(i, end - i + 1));
+			i = end;
+			continue;
+		}
+		out += c;
+	}
+}
+
+inline size_t approximateSize(const CompiledExpr& expr) {
+	size_t bytes = sizeof(CompiledExpr) + expr.program.capacity() * sizeof(Instr) + expr.code.capacity() * sizeof(Bytecode) + expr.types.capacity() * sizeof(TokenKind);
+	bytes += expr.constants.capacity() * sizeof(Value) + expr.functions.capacity() * sizeof(const NativeFunction*);
+	for (const std::wstring& name : expr.variables) bytes += sizeof(std::wstring) + name.capacity() * sizeof(wchar_t);
+	return bytes;
+}
+
+class ExprCache {
+public:
+	struct Stats {
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+		size_t entries = 0;
+		size_t bytes = 0;
+	};
+
+	explicit ExprCache(size_t memoryBudget = 64 << 20, int shardCount = 16)
+		: shards(std::max(shardCount, 1)), shardBudget(memoryBudget / std::max(shardCount, 1)) {}
+
+	std::shared_ptr<const CompiledExpr> get(std::wstring_view src) {
+		thread_local std::wstring key;
+		normalizeSource(src, key);
+		Shard& shard = shards[std::hash<std::wstring>{}(key) % shards.size()];
+		{
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			auto it = shard.index.find(key);
+			if (it != shard.index.end()) {
+				shard.hits++;
+				shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+				return it->second->expr;
+			}
+			shard.misses++;
+		}
+		// The entry owns its string literals, so evicting it frees them.
+		auto compiled = std::make_shared<Compiled>();
+		{
+			LiteralScope literals;
+			compiled->expr = compile(key);
+			compiled->literals = std::move(literals.strings);
+		}
+		std::shared_ptr<const CompiledExpr> expr(compiled, &compiled->expr);
+		// Not cached, so a function registered later is picked up by the next get.
+		if (expr->code.empty()) return expr;
+		size_t bytes = approximateSize(*expr) + 2 * key.capacity() * sizeof(wchar_t) + EntryOverhead;
+		for (const std::wstring& literal : compiled->literals) bytes += sizeof(std::wstring) + literal.capacity() * sizeof(wchar_t);
+		std::lock_guard<std::mutex> lock(shard.mutex);
+		auto it = shard.index.find(key);
+		if (it != shard.index.end()) {
+			shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+			return it->second->expr;
+		}
+		shard.lru.push_front({ key, expr, bytes });
+		shard.index.emplace(key, shard.lru.begin());
+		shard.bytes += bytes;
+		while (shard.bytes > shardBudget && shard.lru.size() > 1) {
+			Entry& victim = shard.lru.back();
+			shard.bytes -= victim.bytes;
+			shard.index.erase(victim.key);
+			shard.lru.pop_back();
+			shard.evictions++;
+		}
+		return expr;
+	}
+
+	Stats stats() const {
+		Stats total;
+		for (const Shard& shard : shards) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			total.hits += shard.hits;
+			total.misses += shard.misses;
+			total.evictions += shard.evictions;
+			total.entries += shard.lru.size();
+			total.bytes += shard.bytes;
+		}
+		return total;
+	}
+
+	void clear() {
+		for (Shard& shard : shards) {
+			std::lock_guard<std::mutex> lock(shard.mutex);
+			shard.index.clear();
+			shard.lru.clear();
+			shard.bytes = 0;
+		}
+	}
+
+private:
+	static constexpr size_t EntryOverhead = 128;
+
+	struct Entry {
+		std::wstring key;
+		std::shared_ptr<const CompiledExpr> expr;
+		size_t bytes;
+	};
+
+	struct Shard {
+		mutable std::mutex mutex;
+		std::list<Entry> lru;
+		std::unordered_map<std::wstring, std::list<Entry>::iterator> index;
+		size_t bytes = 0;
+		uint64_t hits = 0;
+		uint64_t misses = 0;
+		uint64_t evictions = 0;
+	};
+
+	struct Compiled {
+		std::forward_list<std::wstring> literals;
+		CompiledExpr expr;
+	};
+
+	std::vector<Shard> shards;
+	size_t shardBudget;
+};
@@ -0,0 +1,2041 @@
+#pragma once
+#include <map>
+#include <stack>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <iostream>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <forward_list>
+#include <unordered_set>
+#include <unordered_map>
+#include <deque>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+
+// Build with CPP_EVAL_PROFILE=1 to record per-phase timings, per-opcode
+// counts and per-expression latency histograms (see profileReport). When it
+// is 0 the hooks below expand to nothing.
+#ifndef CPP_EVAL_PROFILE
+#define CPP_EVAL_PROFILE 0
+#endif
+
+#if CPP_EVAL_PROFILE
+#include <atomic>
+#include <bit>
+#include <chrono>
+
+enum class ProfilePhase { Tokenize, Compile, Execute, Count };
+
+const int ProfileOps = 64;
+const int LatencyBuckets = 40;
+
+// Heap allocations made by this thread; only counted when the including
+// program also defines CPP_EVAL_PROFILE_ALLOCATIONS (see the end of this file).
+inline thread_local uint64_t profileAllocations = 0;
+
+// Updated only by the owning thread, but with atomic adds so a concurrent
+// profileReset cannot be overwritten by a stale load.
+struct ProfileCounters {
+	std::atomic<uint64_t> calls[static_cast<int>(ProfilePhase::Count)] = {};
+	std::atomic<uint64_t> ns[static_cast<int>(ProfilePhase::Count)] = {};
+	std::atomic<uint64_t> allocations[static_cast<int>(ProfilePhase::Count)] = {};
+	std::atomic<uint64_t> ops[ProfileOps] = {};
+	bool inPhase = false;
+};
+
+// Latency of one source text, shared by every CompiledExpr compiled from it.
+// Bucket k counts runs that took [2^(k-1), 2^k) ns.
+struct ExprProfile {
+	std::wstring source;
+	std::atomic<uint64_t> runs{0};
+	std::atomic<uint64_t> ns{0};
+	std::atomic<uint64_t> buckets[LatencyBuckets] = {};
+};
+
+struct ProfileRegistry {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<ProfileCounters>> threads;
+	std::unordered_map<std::wstring, std::unique_ptr<ExprProfile>> expressions;
+};
+
+// Leaked on purpose so thread-local counters may outlive static destruction.
+inline ProfileRegistry& profileRegistry() {
+	static ProfileRegistry* registry = new ProfileRegistry;
+	return *registry;
+}
+
+inline ProfileCounters& profileCounters() {
+	thread_local ProfileCounters* counters = [] {
+		ProfileRegistry& registry = profileRegistry();
+		std::lock_guard<std::mutex> lock(registry.mutex);
+		registry.threads.push_back(std::make_unique<ProfileCounters>());
+		return registry.threads.back().get();
+	}();
+	return *counters;
+}
+
+inline ExprProfile* exprProfile(std::wstring_view source) {
+	ProfileRegistry& registry = profileRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	std::unique_ptr<ExprProfile>& entry = registry.expressions[std::wstring(source)];
+	if (!entry) {
+		entry = std::make_unique<ExprProfile>();
+		entry->source = source;
+	}
+	return entry.get();
+}
+
+inline void profileBump(std::atomic<uint64_t>& counter, uint64_t n = 1) {
+	counter.fetch_add(n, std::memory_order_relaxed);
+}
+
+// Times one phase on this thread; phases nested in another one (constant
+// folding runs the VM inside compile) are attributed to the outer phase.
+class ProfileScope {
+public:
+	explicit ProfileScope(ProfilePhase phase, ExprProfile* expr = nullptr)
+		: counters(profileCounters()), phase(static_cast<int>(phase)), expr(expr), active(!counters.inPhase) {
+		if (!active) return;
+		counters.inPhase = true;
+		allocations = profileAllocations;
+		start = std::chrono::steady_clock::now();
+	}
+
+	~ProfileScope() {
+		if (!active) return;
+		uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		counters.inPhase = false;
+		profileBump(counters.calls[phase]);
+		profileBump(counters.ns[phase], ns);
+		profileBump(counters.allocations[phase], profileAllocations - allocations);
+		if (expr) {
+			expr->runs.fetch_add(1, std::memory_order_relaxed);
+			expr->ns.fetch_add(ns, std::memory_order_relaxed);
+			expr->buckets[std::min<int>(std::bit_width(ns), LatencyBuckets - 1)].fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+
+	// False when nested in another phase, whose work this scope belongs to.
+	bool outermost() const { return active; }
+
+private:
+	ProfileCounters& counters;
+	int phase;
+	ExprProfile* expr;
+	bool active;
+	uint64_t allocations = 0;
+	std::chrono::steady_clock::time_point start;
+};
+
+#define CPP_EVAL_PROFILE_SCOPE(...) ProfileScope profileScope(__VA_ARGS__)
+#else
+#define CPP_EVAL_PROFILE_SCOPE(...)
+#endif
+
+inline const std::wstring* intern(const std::wstring& str) {
+	static std::unordered_set<std::wstring> pool;
+	static std::mutex mutex;
+	std::lock_guard<std::mutex> lock(mutex);
+	return &*pool.insert(str).first;
+}
+
+enum class CharType {
+	Unknown,
+	WhiteSpace,
+	NumberLiteral,
+	StringLiteral,
+	IdentifierAndKeyword,
+	OperatorAndPunctuator,
+};
+
+constexpr CharType getCharType(wchar_t c){
+	if (L' ' == c || L'\t' == c || L'\r' == c || L'\n' == c) {
+		return CharType::WhiteSpace;
+	}
+	if (L'0' <= c && c <= L'9') {
+		return CharType::NumberLiteral;
+	}
+	if (c == L'\"') {
+		return CharType::StringLiteral;
+	}
+	if (L'a' <= c && c <= L'z' || L'A' <= c && c <= L'Z' || L'[' == c || L']' == c) {
+		return CharType::IdentifierAndKeyword;
+	}
+	if (33 <= c && c <= 47 && c != '\'' ||
+		58 <= c && c <= 64 ||
+		91 <= c && c <= 96 ||
+		123 <= c && c <= 126) {
+		return CharType::OperatorAndPunctuator;
+	}
+	return CharType::Unknown;
+}
+
+enum class TokenKind {
+	Unknown,
+	True, False,
+	Int, Float,
+	String,
+	Variable,
+	
+	Add, Sub, Mul, Div,
+	Negative,
+	IsEqual, IsNotEqual, IsGreat, IsLess, IsGreatEqual, IsLessEqual,
+	LeftParent, RightParent, Comma,
+
+	Or, And, Not,
+	
+	Function,
+};
+
+constexpr int evalPriority(TokenKind kind) {
+	switch (kind) {
+	case TokenKind::LeftParent: return -2;
+	case TokenKind::And: return -1;
+	case TokenKind::Or: return 0;
+	case TokenKind::Not: return 1;
+	case TokenKind::IsEqual: case TokenKind::IsNotEqual:
+	case TokenKind::IsGreat: case TokenKind::IsLess:
+	case TokenKind::IsGreatEqual: case TokenKind::IsLessEqual: return 2;
+	case TokenKind::Add: case TokenKind::Sub: return 3;
+	case TokenKind::Mul: case TokenKind::Div: return 4;
+	case TokenKind::Negative: return 5;
+	case TokenKind::Function: return 6;
+	default: return 0;
+	}
+}
+
+constexpr const char* kind2String(TokenKind kind) {
+	switch (kind) {
+	case TokenKind::Unknown: return "Unknown";
+	case TokenKind::True: return "True";
+	case TokenKind::False: return "False";
+	case TokenKind::Int: return "Int";
+	case TokenKind::Float: return "Float";
+	case TokenKind::String: return "String";
+	case TokenKind::Variable: return "Variable";
+	case TokenKind::Add: return "Add";
+	case TokenKind::Sub: return "Sub";
+	case TokenKind::Mul: return "Mul";
+	case TokenKind::Div: return "Div";
+	case TokenKind::Negative: return "Negative";
+	case TokenKind::IsEqual: return "IsEqual";
+	case TokenKind::IsNotEqual: return "IsNotEqual";
+	case TokenKind::IsGreat: return "IsGreat";
+	case TokenKind::IsLess: return "IsLess";
+	case TokenKind::IsGreatEqual: return "IsGreatEqual";
+	case TokenKind::IsLessEqual: return "IsLessEqual";
+	case TokenKind::LeftParent: return "LeftParent";
+	case TokenKind::RightParent: return "RightParent";
+	case TokenKind::Comma: return "Comma";
+	case TokenKind::Or: return "Or";
+	case TokenKind::And: return "And";
+	case TokenKind::Not: return "Not";
+	case TokenKind::Function: return "Function";
+	}
+	return "Unknown";
+}
+
+struct Token {
+	TokenKind type;
+	std::wstring data;
+	void print() {
+		std::cout << "[" << kind2String(type);
+		std::wcout << ", \"" << data << L"\"]\n";
+	}
+};
+
+struct Value {
+	TokenKind type = TokenKind::Unknown;
+	// Set when s points into the intern() pool, where equal text means equal pointers.
+	bool interned = false;
+	union {
+		int64_t i;
+		double f;
+		const std::wstring* s;
+	};
+	Value() : i(0) {}
+	static Value fromInt(int64_t v) { Value r; r.type = TokenKind::Int; r.i = v; return r; }
+	static Value fromFloat(double v) { Value r; r.type = TokenKind::Float; r.f = v; return r; }
+	static Value fromBool(bool v) { Value r; r.type = v ? TokenKind::True : TokenKind::False; return r; }
+	static Value fromString(const std::wstring* v) { Value r; r.type = TokenKind::String; r.s = v; return r; }
+	static Value fromInterned(const std::wstring* v) { Value r = fromString(v); r.interned = true; return r; }
+	Token toToken() const {
+		switch (type) {
+		case TokenKind::Int: return { type, std::to_wstring(i) };
+		case TokenKind::Float: return { type, std::to_wstring(f) };
+		case TokenKind::True: return { type, L"true" };
+		case TokenKind::False: return { type, L"false" };
+		case TokenKind::String: return { type, *s };
+		default: return { TokenKind::Unknown, L"" };
+		}
+	}
+};
+
+// While a LiteralScope is alive, string literals compiled on its thread are
+// kept in the scope and freed with it instead of growing the intern() pool,
+// which never shrinks. Expressions compiled inside must not outlive it.
+class LiteralScope {
+public:
+	LiteralScope() : previous(current()) { current() = this; }
+	~LiteralScope() { current() = previous; }
+	LiteralScope(const LiteralScope&) = delete;
+	LiteralScope& operator=(const LiteralScope&) = delete;
+	static LiteralScope*& current() {
+		thread_local LiteralScope* scope = nullptr;
+		return scope;
+	}
+	std::forward_list<std::wstring> strings;
+private:
+	LiteralScope* previous;
+};
+
+inline Value literalString(std::wstring_view text) {
+	if (LiteralScope* scope = LiteralScope::current()) return Value::fromString(&scope->strings.emplace_front(text));
+	return Value::fromInterned(intern(std::wstring(text)));
+}
+
+inline bool isNumber(const Value& v) {
+	return v.type == TokenKind::Int || v.type == TokenKind::Float;
+}
+
+inline bool isBool(const Value& v) {
+	return v.type == TokenKind::True || v.type == TokenKind::False;
+}
+
+// The static type of a value, with True standing for either Bool.
+inline TokenKind typeOf(const Value& v) {
+	return v.type == TokenKind::False ? TokenKind::True : v.type;
+}
+
+inline double toDouble(const Value& v) {
+	return v.type == TokenKind::Int ? static_cast<double>(v.i) : v.f;
+}
+
+// Int arithmetic wraps around in two's complement on overflow, computed on
+// uint64_t so that it is defined behaviour.
+constexpr int64_t negateInt(int64_t a) {
+	return static_cast<int64_t>(0 - static_cast<uint64_t>(a));
+}
+
+// INT64_MIN / -1 wraps like the other Int operations instead of trapping.
+// Division by zero has no Int result: callers check b first and yield an
+// Unknown Value.
+constexpr int64_t divideInt(int64_t a, int64_t b) {
+	return b == -1 ? negateInt(a) : a / b;
+}
+
+struct NativeFunction {
+	std::wstring name;
+	int arity;
+	std::vector<TokenKind> parameters;
+	TokenKind result;
+	std::shared_ptr<void> target;
+	Value (*call)(const void* target, const Value* args, std::forward_list<std::wstring>& temps);
+	void (*batch)(const void* target, const double* const* args, double* out, int n);
+};
+
+template <typename T>
+constexpr TokenKind parameterKind() {
+	if constexpr (std::is_same_v<T, Value>) return TokenKind::Unknown;
+	else if constexpr (std::is_same_v<T, bool>) return TokenKind::True;
+	else if constexpr (std::is_integral_v<T>) return TokenKind::Int;
+	else if constexpr (std::is_floating_point_v<T>) return TokenKind::Float;
+	else if constexpr (std::is_same_v<T, std::wstring> || std::is_same_v<T, std::wstring_view>) return TokenKind::String;
+	else static_assert(sizeof(T) == 0, "unsupported native function type");
+}
+
+inline bool accepts(TokenKind parameter, const Value& v) {
+	switch (parameter) {
+	case TokenKind::Unknown: return true;
+	case TokenKind::True: return isBool(v);
+	case TokenKind::Int: return v.type == TokenKind::Int;
+	case TokenKind::Float: return isNumber(v);
+	case TokenKind::String: return v.type == TokenKind::String;
+	default: return false;
+	}
+}
+
+// Callers check accepts first; a value of the wrong type reads as T().
+template <typename T>
+inline T fromValue(const Value& v) {
+	if (!accepts(parameterKind<T>(), v)) return T();
+	if constexpr (std::is_same_v<T, Value>) return v;
+	else if constexpr (std::is_same_v<T, bool>) return v.type == TokenKind::True;
+	else if constexpr (std::is_integral_v<T>) return static_cast<T>(v.i);
+	else if constexpr (std::is_floating_point_v<T>) return static_cast<T>(toDouble(v));
+	else return T(*v.s);
+}
+
+template <typename T>
+inline Value toValue(T v, std::forward_list<std::wstring>& temps) {
+	if constexpr (std::is_same_v<T, Value>) return v;
+	else if constexpr (std::is_same_v<T, bool>) return Value::fromBool(v);
+	else if constexpr (std::is_integral_v<T>) return Value::fromInt(v);
+	else if constexpr (std::is_floating_point_v<T>) return Value::fromFloat(v);
+	else return Value::fromString(&temps.emplace_front(v));
+}
+
+template <typename Signature>
+struct NativeSignature;
+
+template <typename R, typename... Args>
+struct NativeSignature<R(Args...)> {
+	static constexpr bool numeric = std::is_arithmetic_v<R> && !std::is_same_v<R, bool>
+		&& ((std::is_arithmetic_v<std::decay_t<Args>> && !std::is_same_v<std::decay_t<Args>, bool>) && ...);
+
+	// Arguments of the wrong type, which only undeclared variables and
+	// functions returning Value can produce, make the call Unknown.
+	template <typename F, size_t... I>
+	static Value call(const void* target, const Value* args, std::forward_list<std::wstring>& temps, std::index_sequence<I...>) {
+		if (!(accepts(parameterKind<std::decay_t<Args>>(), args[I]) && ...)) return Value();
+		return toValue<std::decay_t<R>>((*static_cast<const F*>(target))(fromValue<std::decay_t<Args>>(args[I])...), temps);
+	}
+
+	template <typename F>
+	static Value call(const void* target, const Value* args, std::forward_list<std::wstring>& temps) {
+		return call<F>(target, args, temps, std::index_sequence_for<Args...>{});
+	}
+
+	template <typename F, size_t... I>
+	static void batch(const void* target, const double* const* args, double* out, int n, std::index_sequence<I...>) {
+		const F& fn = *static_cast<const F*>(target);
+		for (int i = 0; i < n; i++) out[i] = static_cast<double>(fn(static_cast<std::decay_t<Args>>(args[I][i])...));
+	}
+
+	template <typename F>
+	static void batch(const void* target, const double* const* args, double* out, int n) {
+		batch<F>(target, args, out, n, std::index_sequence_for<Args...>{});
+	}
+};
+
+struct FunctionRegistry {
+	std::deque<NativeFunction> functions;
+	std::unordered_map<std::wstring, int> names;
+	mutable std::shared_mutex mutex;
+
+	FunctionRegistry();
+
+	template <typename Signature, typename F>
+	int add(std::wstring name, F fn) {
+		using Traits = NativeSignature<Signature>;
+		NativeFunction entry = make<Signature>(name, std::move(fn), static_cast<Signature*>(nullptr));
+		entry.call = &Traits::template call<F>;
+		if constexpr (Traits::numeric) entry.batch = &Traits::template batch<F>;
+		else entry.batch = nullptr;
+		std::unique_lock<std::shared_mutex> lock(mutex);
+		auto it = names.find(name);
+		if (it != names.end()) {
+			functions[it->second] = std::move(entry);
+			return it->second;
+		}
+		functions.push_back(std::move(entry));
+		names[name] = functions.size() - 1;
+		return functions.size() - 1;
+	}
+
+	template <typename Signature, typename F, typename R, typename... Args>
+	static NativeFunction make(std::wstring name, F fn, R (*)(Args...)) {
+		NativeFunction entry;
+		entry.name = std::move(name);
+		entry.arity = sizeof...(Args);
+		entry.parameters = { parameterKind<std::decay_t<Args>>()... };
+		entry.result = std::is_same_v<std::decay_t<R>, Value> ? TokenKind::Unknown : parameterKind<std::decay_t<R>>();
+		entry.target = std::make_shared<F>(std::move(fn));
+		return entry;
+	}
+
+	const NativeFunction* find(std::wstring_view name) const {
+		std::shared_lock<std::shared_mutex> lock(mutex);
+		auto it = names.find(std::wstring(name));
+		return it == names.end() ? nullptr : &functions[it->second];
+	}
+};
+
+inline FunctionRegistry& functionRegistry() {
+	static FunctionRegistry registry;
+	return registry;
+}
+
+// Registering is safe while other threads compile, but replacing a function
+// that running expressions already call is not.
+template <typename Signature, typename F>
+int registerFunction(std::wstring name, F fn) {
+	return functionRegistry().add<Signature>(std::move(name), std::move(fn));
+}
+
+inline FunctionRegistry::FunctionRegistry() {
+	add<double(double)>(L"sin", [](double x) { return std::sin(x); });
+	add<double(double)>(L"cos", [](double x) { return std::cos(x); });
+	add<double(double)>(L"tan", [](double x) { return std::tan(x); });
+	add<double(double, double)>(L"pow", [](double x, double y) { return std::pow(x, y); });
+	add<double(double)>(L"sqrt", [](double x) { return std::sqrt(x); });
+	add<double(double)>(L"log", [](double x) { return std::log(x); });
+	add<double(double)>(L"exp", [](double x) { return std::exp(x); });
+	add<Value(Value)>(L"abs", [](Value x) {
+		if (x.type == TokenKind::Int) return Value::fromInt(x.i < 0 ? negateInt(x.i) : x.i);
+		if (x.type == TokenKind::Float) return Value::fromFloat(std::fabs(x.f));
+		return Value();
+	});
+	add<Value(Value, Value)>(L"min", [](Value x, Value y) {
+		if (!isNumber(x) || !isNumber(y)) return Value();
+		return toDouble(y) < toDouble(x) ? y : x;
+	});
+	add<Value(Value, Value)>(L"max", [](Value x, Value y) {
+		if (!isNumber(x) || !isNumber(y)) return Value();
+		return toDouble(y) > toDouble(x) ? y : x;
+	});
+}
+
+struct TokenView {
+	TokenKind type;
+	int offset;
+	int length;
+	constexpr std::wstring_view text(std::wstring_view src) const { return src.substr(offset, length); }
+};
+
+constexpr TokenKind keywordKind(std::wstring_view word) {
+	switch (word.size()) {
+	case 2:
+		if (word == L"or") return TokenKind::Or;
+		break;
+	case 3:
+		switch (word[0]) {
+		case L'a': if (word == L"and") return TokenKind::And; break;
+		case L'n': if (word == L"not") return TokenKind::Not; break;
+		}
+		break;
+	case 4:
+		if (word == L"true") return TokenKind::True;
+		break;
+	case 5:
+		if (word == L"false") return TokenKind::False;
+		break;
+	}
+	return TokenKind::Variable;
+}
+
+// Whether what follows index can only be an argument: '(' or the start of
+// an operand. An identifier is a call only then, as in "sin(1)" or "sin 1",
+// so names of registered functions still work as variables ("max - 1").
+constexpr bool startsArgument(std::wstring_view src, size_t index) {
+	while (index < src.size() && getCharType(src[index]) == CharType::WhiteSpace) index++;
+	if (index == src.size()) return false;
+	CharType type = getCharType(src[index]);
+	if (src[index] == L'(' || type == CharType::NumberLiteral || type == CharType::StringLiteral) return true;
+	if (type != CharType::IdentifierAndKeyword) return false;
+	size_t end = index;
+	while (end < src.size() && (getCharType(src[end]) == CharType::IdentifierAndKeyword || getCharType(src[end]) == CharType::NumberLiteral || src[end] == L'_')) end++;
+	TokenKind kind = keywordKind(src.substr(index, end - index));
+	return kind == TokenKind::Variable || kind == TokenKind::True || kind == TokenKind::False;
+}
+
+inline std::vector<TokenView> tokenize(std::wstring_view src) {
+	CPP_EVAL_PROFILE_SCOPE(ProfilePhase::Tokenize);
+	std::vector<TokenView> result;
+	result.reserve(src.size() / 2 + 1);
+	int index = 0;
+	int size = src.size();
+	while (index < size) {
+		int start = index;
+		switch (getCharType(src[index])) {
+		case (CharType::WhiteSpace): {
+			index++;
+			break;
+		}
+		case (CharType::NumberLiteral): {
+			bool isFloat = false;
+			while (index < size && (getCharType(src[index]) == CharType::NumberLiteral || src[index] == L'.')) {
+				if (src[index] == L'.') isFloat = true;
+				index++;
+			}
+			result.push_back({ isFloat ? TokenKind::Float : TokenKind::Int, start, index - start });
+			break;
+		}
+		case (CharType::StringLiteral): {
+			index++;
+			while (index < size && src[index] != L'\"') index++;
+			if (index == size) result.push_back({ TokenKind::Unknown, start, index - start });
+			else result.push_back({ TokenKind::String, start + 1, index - start - 1 });
+			index++;
+			break;
+		}
+		case (CharType::IdentifierAndKeyword): {
+			while (index < size && (getCharType(src[index]) == CharType::IdentifierAndKeyword
+					|| getCharType(src[index]) == CharType::NumberLiteral || src[index] == L'_')) {
+				index++;
+			}
+			std::wstring_view word = src.substr(start, index - start);
+			TokenKind kind = keywordKind(word);
+			if (kind == TokenKind::Variable && startsArgument(src, index)) kind = TokenKind::Function;
+			result.push_back({ kind, start, index - start });
+			break;
+		}
+		case (CharType::OperatorAndPunctuator): {
+			wchar_t next = index + 1 < size ? src[index + 1] : L'\0';
+			switch (src[index]) {
+			case L'+': result.push_back({ TokenKind::Add, start, 1 }); index++; break;
+			case L'-': {
+				TokenKind last = result.empty() ? TokenKind::Unknown : result[result.size() - 1].type;
+				bool binary = last == TokenKind::Int || last == TokenKind::Float || last == TokenKind::Variable || last == TokenKind::RightParent;
+				result.push_back({ binary ? TokenKind::Sub : TokenKind::Negative, start, 1 });
+				index++;
+				break;
+			}
+			case L'*': result.push_back({ TokenKind::Mul, start, 1 }); index++; break;
+			case L'/': result.push_back({ TokenKind::Div, start, 1 }); index++; break;
+			case L'(': result.push_back({ TokenKind::LeftParent, start, 1 }); index++; break;
+			case L')': result.push_back({ TokenKind::RightParent, start, 1 }); index++; break;
+			case L',': result.push_back({ TokenKind::Comma, start, 1 }); index++; break;
+			case L'=':
+				if (next == L'=') { result.push_back({ TokenKind::IsEqual, start, 2 }); index += 2; }
+				else { result.push_back({ TokenKind::Unknown, start, 1 }); index++; }
+				break;
+			case L'!':
+				if (next == L'=') { result.push_back({ TokenKind::IsNotEqual, start, 2 }); index += 2; }
+				else { result.push_back({ TokenKind::Unknown, start, 1 }); index++; }
+				break;
+			case L'>':
+				if (next == L'=') { result.push_back({ TokenKind::IsGreatEqual, start, 2 }); index += 2; }
+				else { result.push_back({ TokenKind::IsGreat, start, 1 }); index++; }
+				break;
+			case L'<':
+				if (next == L'=') { result.push_back({ TokenKind::IsLessEqual, start, 2 }); index += 2; }
+				else { result.push_back({ TokenKind::IsLess, start, 1 }); index++; }
+				break;
+			default:
+				result.push_back({ TokenKind::Unknown, start, 1 });
+				index++;
+				break;
+			}
+			break;
+		}
+		default: {
+			result.push_back({ TokenKind::Unknown, start, 1 });
+			index++;
+			break;
+		}
+		}
+	}
+	return result;
+}
+
+inline double parseFloat(std::wstring_view text) {
+	wchar_t buffer[64];
+	if (text.size() >= 64) return std::stod(std::wstring(text));
+	std::copy(text.begin(), text.end(), buffer);
+	buffer[text.size()] = L'\0';
+	return std::wcstod(buffer, nullptr);
+}
+
+// Whether text, a run of digits, is at most INT64_MAX.
+constexpr bool fitsInt(std::wstring_view text) {
+	while (text.size() > 1 && text[0] == L'0') text.remove_prefix(1);
+	std::wstring_view max = L"9223372036854775807";
+	return text.size() < max.size() || (text.size() == max.size() && text <= max);
+}
+
+constexpr int64_t parseInt(std::wstring_view text) {
+	int64_t result = 0;
+	for (wchar_t c : text) result = result * 10 + (c - L'0');
+	return result;
+}
+
+struct Instr {
+	TokenKind op;
+	Value value;
+	int operand = 0;
+	const NativeFunction* function = nullptr;
+};
+
+enum class OpCode : uint8_t {
+	Move,
+	Negative, Not,
+	Add, Sub, Mul, Div,
+	IsEqual, IsNotEqual, IsGreat, IsLess, IsGreatEqual, IsLessEqual,
+	And, Or,
+	Call,
+	JumpIfTrue, JumpIfFalse,
+	// Emitted only where both operand types are known at compile time, and so
+	// do not check them. Comparisons only come as < and <= with the operands
+	// swapped for > and >=.
+	NegativeInt, NegativeFloat,
+	AddInt, SubInt, MulInt, DivInt,
+	AddFloat, SubFloat, MulFloat, DivFloat,
+	Concat,
+	IsEqualInt, IsNotEqualInt, IsLessInt, IsLessEqualInt,
+	IsEqualFloat, IsNotEqualFloat, IsLessFloat, IsLessEqualFloat,
+	IsEqualString, IsNotEqualString, IsEqualBool, IsNotEqualBool,
+	IntToFloat,
+	// Copy constants[offset()] or slots[offset()] into a, for indexes past
+	// what a register can address.
+	LoadConstant, LoadSlot,
+	Return,
+};
+
+// The top two bits of a register select its space (RegisterSpace) and the
+// low bits index into it. a is the destination (or tested) register and b, c
+// are sources; jumps keep their forward offset in b | c << 16 and Call keeps
+// its function index in c.
+enum RegisterSpace : uint16_t {
+	Temporary = 0 << 14,
+	Slot = 1 << 14,
+	Constant = 2 << 14,
+	RegisterIndex = (1 << 14) - 1,
+};
+
+struct Bytecode {
+	OpCode op;
+	uint16_t a = 0, b = 0, c = 0;
+	uint32_t offset() const { return b | static_cast<uint32_t>(c) << 16; }
+	void setOffset(uint32_t offset) { b = offset & 0xFFFF; c = offset >> 16; }
+};
+
+static_assert(sizeof(Bytecode) == 8);
+
+struct CompiledExpr {
+	std::vector<Instr> program;
+	std::vector<std::wstring> variables;
+	std::vector<Value> constants;
+	std::vector<const NativeFunction*> functions;
+	std::vector<Bytecode> code;
+	// Declared slot types (True for Bool, Unknown for undeclared); empty unless
+	// compiled with types. Slots passed to execute must hold these types.
+	std::vector<TokenKind> types;
+	int maxDepth = 0;
+	int temporaries = 0;
+#if CPP_EVAL_PROFILE
+	ExprProfile* profile = nullptr;
+#endif
+	int slotOf(std::wstring_view name) const;
+	Value execute(const Value* slots, std::forward_list<std::wstring>& temps) const;
+	Token run() const;
+	Token run(const std::vector<Value>& slots) const;
+	Token run(const std::map<std::wstring, Value>& bindings) const;
+	bool runBatch(std::span<const std::span<const double>> columns, std::span<double> out) const;
+};
+
+constexpr bool isPrefixOperator(TokenKind op) {
+	return op == TokenKind::Negative || op == TokenKind::Not || op == TokenKind::Function;
+}
+
+inline int operandCount(const Instr& instr) {
+	switch (instr.op) {
+	case TokenKind::Int: case TokenKind::Float: case TokenKind::String: case TokenKind::True: case TokenKind::False:
+	case TokenKind::Variable:
+		return 0;
+	case TokenKind::Negative: case TokenKind::Not:
+		return 1;
+	case TokenKind::Function:
+		return instr.function->arity;
+	default:
+		return 2;
+	}
+}
+
+inline std::vector<Instr> optimize(const std::vector<Instr>& program);
+inline void assemble(CompiledExpr& expr);
+inline std::wstring checkTypes(const CompiledExpr& expr);
+
+// Malformed input (a missing or extra operand, unbalanced parentheses, an
+// unknown function, a wrong argument count or an operand type error) yields
+// an empty expression, with the reason in error if given.
+inline CompiledExpr compile(std::wstring_view src, const std::vector<TokenView>& tokens, std::wstring* error = nullptr) {
+	CPP_EVAL_PROFILE_SCOPE(ProfilePhase::Compile);
+	CompiledExpr result;
+#if CPP_EVAL_PROFILE
+	result.profile = exprProfile(src);
+#endif
+	if (tokens.empty()) return result;
+	std::vector<Instr> program;
+	std::wstring message;
+	auto emit = [&](const TokenView& token, int argc) {
+		Instr instr{ token.type, {} };
+		std::wstring_view text = token.text(src);
+		switch (token.type) {
+		case TokenKind::Int:
+			if (!fitsInt(text)) {
+				if (message.empty()) message = L"integer literal out of range: " + std::wstring(text);
+				return;
+			}
+			instr.value = Value::fromInt(parseInt(text));
+			break;
+		case TokenKind::Float: instr.value = Value::fromFloat(parseFloat(text)); break;
+		case TokenKind::True: instr.value = Value::fromBool(true); break;
+		case TokenKind::False: instr.value = Value::fromBool(false); break;
+		case TokenKind::String: instr.value = literalString(text); break;
+		case TokenKind::Variable:
+			instr.operand = result.slotOf(text);
+			if (instr.operand < 0) {
+				instr.operand = result.variables.size();
+				result.variables.push_back(std::wstring(text));
+			}
+			break;
+		case TokenKind::Function:
+			instr.function = functionRegistry().find(text);
+			if (!instr.function) {
+				if (message.empty()) message = L"unknown function " + std::wstring(text);
+				return;
+			}
+			if (argc != instr.function->arity) {
+				if (message.empty()) {
+					message = std::wstring(text) + L" expects " + std::to_wstring(instr.function->arity) + L" argument" + (instr.function->arity == 1 ? L"" : L"s") + L", got " + std::to_wstring(argc);
+				}
+				return;
+			}
+			break;
+		}
+		program.push_back(instr);
+	};
+	auto unexpected = [&](const TokenView& token) {
+		message = L"unexpected " + std::wstring(token.type == TokenKind::String ? L"string" : token.text(src)) + L" at " + std::to_wstring(token.offset);
+	};
+	std::stack<TokenView, std::vector<TokenView>> stack;
+	std::vector<bool> callParents;
+	std::vector<int> arities;
+	// Whether the next token has to start an operand.
+	bool operand = true;
+	for (int n = 0; n < tokens.size() && message.empty(); n++) {
+		const TokenView& token = tokens[n];
+		switch (token.type) {
+		case TokenKind::Int: case TokenKind::Float: case TokenKind::String: case TokenKind::True: case TokenKind::False:
+		case TokenKind::Variable:
+			if (!operand) { unexpected(token); break; }
+			emit(token, 0);
+			operand = false;
+			break;
+		case TokenKind::LeftParent: {
+			if (!operand) { unexpected(token); break; }
+			bool call = n > 0 && tokens[n - 1].type == TokenKind::Function;
+			callParents.push_back(call);
+			if (call) arities.push_back(n + 1 < tokens.size() && tokens[n + 1].type == TokenKind::RightParent ? 0 : 1);
+			stack.push(token);
+			break;
+		}
+		case TokenKind::Comma:
+			if (operand || callParents.empty() || callParents.back() == false) { unexpected(token); break; }
+			while (stack.top().type != TokenKind::LeftParent) {
+				emit(stack.top(), 1); stack.pop();
+			}
+			arities.back()++;
+			operand = true;
+			break;
+		case TokenKind::RightParent: {
+			if (callParents.empty() || (operand && !(tokens[n - 1].type == TokenKind::LeftParent && callParents.back()))) {
+				unexpected(token);
+				break;
+			}
+			while (stack.top().type != TokenKind::LeftParent) {
+				emit(stack.top(), 1); stack.pop();
+			}
+			stack.pop();
+			if (callParents.back()) {
+				emit(stack.top(), arities.back()); stack.pop();
+				arities.pop_back();
+			}
+			callParents.pop_back();
+			operand = false;
+			break;
+		}
+		case TokenKind::Negative: case TokenKind::Not: case TokenKind::Function:
+			if (!operand) { unexpected(token); break; }
+			stack.push(token);
+			break;
+		case TokenKind::Unknown:
+			unexpected(token);
+			break;
+		default:
+			if (operand) { unexpected(token); break; }
+			while (stack.empty() == false && evalPriority(token.type) <= evalPriority(stack.top().type)) {
+				emit(stack.top(), 1); stack.pop();
+			}
+			stack.push(token);
+			operand = true;
+			break;
+		}
+	}
+	if (message.empty() && operand) message = L"missing operand at end";
+	if (message.empty() && !callParents.empty()) message = L"missing )";
+	while (message.empty() && stack.empty() == false) {
+		emit(stack.top(), 1); stack.pop();
+	}
+	if (!message.empty()) {
+		if (error) *error = std::move(message);
+		return CompiledExpr();
+	}
+	result.program = optimize(program);
+	// Undeclared variables check as Unknown, so this rejects only operations
+	// that no binding could make valid, such as sin("a").
+	message = checkTypes(result);
+	if (!message.empty()) {
+		if (error) *error = std::move(message);
+		return CompiledExpr();
+	}
+	assemble(result);
+	if (result.code.empty()) {
+		if (error) *error = L"expression nested too deeply";
+		return CompiledExpr();
+	}
+	return result;
+}
+
+inline CompiledExpr compile(std::wstring_view src) {
+	return compile(src, tokenize(src));
+}
+
+inline CompiledExpr compile(std::wstring_view src, std::wstring& error) {
+	error.clear();
+	return compile(src, tokenize(src), &error);
+}
+
+inline const wchar_t* typeName(TokenKind type) {
+	switch (type) {
+	case TokenKind::Int: return L"Int";
+	case TokenKind::Float: return L"Float";
+	case TokenKind::String: return L"String";
+	case TokenKind::True: case TokenKind::False: return L"Bool";
+	default: return L"Unknown";
+	}
+}
+
+inline const wchar_t* operatorSymbol(TokenKind op) {
+	switch (op) {
+	case TokenKind::Add: return L"+";
+	case TokenKind::Sub: case TokenKind::Negative: return L"-";
+	case TokenKind::Mul: return L"*";
+	case TokenKind::Div: return L"/";
+	case TokenKind::IsEqual: return L"==";
+	case TokenKind::IsNotEqual: return L"!=";
+	case TokenKind::IsGreat: return L">";
+	case TokenKind::IsLess: return L"<";
+	case TokenKind::IsGreatEqual: return L">=";
+	case TokenKind::IsLessEqual: return L"<=";
+	case TokenKind::And: return L"and";
+	case TokenKind::Or: return L"or";
+	case TokenKind::Not: return L"not";
+	default: return L"?";
+	}
+}
+
+// Result type of instr given the types of its operands, with True standing
+// for Bool and Unknown for a type only known at run time. Operands that no
+// run could accept are reported through error, if given. Variables are
+// typed by the caller.
+inline TokenKind inferType(const Instr& instr, const TokenKind* args, std::wstring* error) {
+	int count = operandCount(instr);
+	TokenKind a = count ? args[0] : TokenKind::Unknown;
+	TokenKind b = count ? args[count - 1] : TokenKind::Unknown;
+	auto number = [](TokenKind t) { return t == TokenKind::Int || t == TokenKind::Float || t == TokenKind::Unknown; };
+	auto boolean = [](TokenKind t) { return t == TokenKind::True || t == TokenKind::Unknown; };
+	auto fail = [&]() {
+		if (error && error->empty()) {
+			*error = std::wstring(L"cannot apply ") + operatorSymbol(instr.op) + L" to " + typeName(a);
+			if (count == 2) *error += std::wstring(L" and ") + typeName(b);
+		}
+		return TokenKind::Unknown;
+	};
+	switch (instr.op) {
+	case TokenKind::Int: case TokenKind::Float: case TokenKind::String: case TokenKind::True: case TokenKind::False:
+		return typeOf(instr.value);
+	case TokenKind::Negative:
+		return number(a) ? a : fail();
+	case TokenKind::Not:
+		return boolean(a) ? TokenKind::True : fail();
+	case TokenKind::Add:
+		if (a == TokenKind::String || b == TokenKind::String) {
+			bool strings = (a == TokenKind::String || a == TokenKind::Unknown) && (b == TokenKind::String || b == TokenKind::Unknown);
+			return strings ? TokenKind::String : fail();
+		}
+		[[fallthrough]];
+	case TokenKind::Sub: case TokenKind::Mul: case TokenKind::Div:
+		if (!number(a) || !number(b)) return fail();
+		if (a == TokenKind::Float || b == TokenKind::Float) return TokenKind::Float;
+		return a == TokenKind::Int && b == TokenKind::Int ? TokenKind::Int : TokenKind::Unknown;
+	case TokenKind::IsGreat: case TokenKind::IsLess: case TokenKind::IsGreatEqual: case TokenKind::IsLessEqual:
+		return number(a) && number(b) ? TokenKind::True : fail();
+	case TokenKind::IsEqual: case TokenKind::IsNotEqual:
+		if (a != TokenKind::Unknown && b != TokenKind::Unknown && (number(a) != number(b) || (!number(a) && a != b))) return fail();
+		return TokenKind::True;
+	case TokenKind::And: case TokenKind::Or:
+		return boolean(a) && boolean(b) ? TokenKind::True : fail();
+	case TokenKind::Function: {
+		const NativeFunction& fn = *instr.function;
+		for (int k = 0; k < count; k++) {
+			TokenKind parameter = fn.parameters[k];
+			TokenKind arg = args[k];
+			if (parameter == TokenKind::Unknown || arg == TokenKind::Unknown || arg == parameter) continue;
+			if (parameter == TokenKind::Float && arg == TokenKind::Int) continue;
+			if (error && error->empty()) {
+				*error = fn.name + L" expects " + typeName(parameter) + L" for argument " + std::to_wstring(k + 1) + L", not " + typeName(arg);
+			}
+			return TokenKind::Unknown;
+		}
+		return fn.result;
+	}
+	default:
+		return TokenKind::Unknown;
+	}
+}
+
+// Returns the first type error in expr's program, or an empty string.
+inline std::wstring checkTypes(const CompiledExpr& expr) {
+	std::wstring error;
+	std::vector<TokenKind> stack;
+	for (const Instr& instr : expr.program) {
+		int count = operandCount(instr);
+		TokenKind type = TokenKind::Unknown;
+		if (instr.op == TokenKind::Variable) type = expr.types.empty() ? TokenKind::Unknown : expr.types[instr.operand];
+		else type = inferType(instr, stack.data() + stack.size() - count, &error);
+		if (!error.empty()) return error;
+		stack.resize(stack.size() - count);
+		stack.push_back(type);
+	}
+	return error;
+}
+
+// Compiles src with declared variable types: Int, Float, String, or True for
+// Bool. Operations whose operand types are then all known become specialized
+// opcodes, with Int operands of Float operations promoted explicitly; the
+// rest, such as those on undeclared variables, keep their run-time checks.
+// A type error such as "a" - 1 is reported through error and yields an
+// empty expression instead of failing at run time.
+inline CompiledExpr compile(std::wstring_view src, const std::map<std::wstring, TokenKind>& types, std::wstring& error) {
+	CompiledExpr result = compile(src, error);
+	if (result.program.empty()) return result;
+	result.types.assign(result.variables.size(), TokenKind::Unknown);
+	for (int i = 0; i < result.variables.size(); i++) {
+		auto it = types.find(result.variables[i]);
+		if (it != types.end()) result.types[i] = it->second == TokenKind::False ? TokenKind::True : it->second;
+	}
+	error = checkTypes(result);
+	if (!error.empty()) return {};
+	assemble(result);
+	if (result.code.empty()) error = L"expression nested too deeply";
+	return result;
+}
+
+inline int CompiledExpr::slotOf(std::wstring_view name) const {
+	for (int i = 0; i < variables.size(); i++) {
+		if (variables[i] == name) return i;
+	}
+	return -1;
+}
+
+// Int division does not come through here; see divideInt.
+template <typename Op>
+inline Value arithmetic(const Value& a, const Value& b, Op op) {
+	if (a.type == TokenKind::Int && b.type == TokenKind::Int) {
+		return Value::fromInt(static_cast<int64_t>(op(static_cast<uint64_t>(a.i), static_cast<uint64_t>(b.i))));
+	}
+	if (isNumber(a) && isNumber(b)) return Value::fromFloat(op(toDouble(a), toDouble(b)));
+	assert(false);
+	return {};
+}
+
+template <typename Op>
+inline Value compare(const Value& a, const Value& b, Op op) {
+	if (a.type == TokenKind::Int && b.type == TokenKind::Int) return Value::fromBool(op(a.i, b.i));
+	if (isNumber(a) && isNumber(b)) return Value::fromBool(op(toDouble(a), toDouble(b)));
+	assert(false);
+	return {};
+}
+
+inline bool equalStrings(const Value& a, const Value& b) {
+	return a.s == b.s || (!(a.interned && b.interned) && *a.s == *b.s);
+}
+
+inline bool equals(const Value& a, const Value& b) {
+	if (a.type == TokenKind::Int && b.type == TokenKind::Int) return a.i == b.i;
+	if (isNumber(a) && isNumber(b)) return toDouble(a) == toDouble(b);
+	if (a.type == TokenKind::String && b.type == TokenKind::String) return equalStrings(a, b);
+	if (isBool(a) && isBool(b)) return a.type == b.type;
+	assert(false);
+	return false;
+}
+
+inline OpCode opcodeFor(TokenKind op) {
+	switch (op) {
+	case TokenKind::Negative: return OpCode::Negative;
+	case TokenKind::Not: return OpCode::Not;
+	case TokenKind::Add: return OpCode::Add;
+	case TokenKind::Sub: return OpCode::Sub;
+	case TokenKind::Mul: return OpCode::Mul;
+	case TokenKind::Div: return OpCode::Div;
+	case TokenKind::IsEqual: return OpCode::IsEqual;
+	case TokenKind::IsNotEqual: return OpCode::IsNotEqual;
+	case TokenKind::IsGreat: return OpCode::IsGreat;
+	case TokenKind::IsLess: return OpCode::IsLess;
+	case TokenKind::IsGreatEqual: return OpCode::IsGreatEqual;
+	case TokenKind::IsLessEqual: return OpCode::IsLessEqual;
+	case TokenKind::And: return OpCode::And;
+	case TokenKind::Or: return OpCode::Or;
+	default: assert(false); return OpCode::Return;
+	}
+}
+
+// The specialized opcode for a binary op on operands of types a and b, or
+// the generic one when they are not both known. Mixed Int and Float operands
+// get the Float opcode and > / >= get < / <=, so the caller promotes or swaps
+// the operands to match.
+inline OpCode typedOpcode(TokenKind op, TokenKind a, TokenKind b) {
+	bool ints = a == TokenKind::Int && b == TokenKind::Int;
+	if ((a == TokenKind::Int || a == TokenKind::Float) && (b == TokenKind::Int || b == TokenKind::Float)) {
+		switch (op) {
+		case TokenKind::Add: return ints ? OpCode::AddInt : OpCode::AddFloat;
+		case TokenKind::Sub: return ints ? OpCode::SubInt : OpCode::SubFloat;
+		case TokenKind::Mul: return ints ? OpCode::MulInt : OpCode::MulFloat;
+		case TokenKind::Div: return ints ? OpCode::DivInt : OpCode::DivFloat;
+		case TokenKind::IsEqual: return ints ? OpCode::IsEqualInt : OpCode::IsEqualFloat;
+		case TokenKind::IsNotEqual: return ints ? OpCode::IsNotEqualInt : OpCode::IsNotEqualFloat;
+		case TokenKind::IsGreat: case TokenKind::IsLess: return ints ? OpCode::IsLessInt : OpCode::IsLessFloat;
+		case TokenKind::IsGreatEqual: case TokenKind::IsLessEqual: return ints ? OpCode::IsLessEqualInt : OpCode::IsLessEqualFloat;
+		default: break;
+		}
+	}
+	if (a == TokenKind::String && b == TokenKind::String) {
+		if (op == TokenKind::Add) return OpCode::Concat;
+		if (op == TokenKind::IsEqual) return OpCode::IsEqualString;
+		if (op == TokenKind::IsNotEqual) return OpCode::IsNotEqualString;
+	}
+	if (a == TokenKind::True && b == TokenKind::True) {
+		if (op == TokenKind::IsEqual) return OpCode::IsEqualBool;
+		if (op == TokenKind::IsNotEqual) return OpCode::IsNotEqualBool;
+	}
+	return opcodeFor(op);
+}
+
+// The generic opcode with the same effect as a specialized one on operands of
+// its types, for consumers that only handle the generic set. IntToFloat has
+// none and is returned as is.
+constexpr OpCode genericOpcode(OpCode op) {
+	switch (op) {
+	case OpCode::NegativeInt: case OpCode::NegativeFloat: return OpCode::Negative;
+	case OpCode::AddInt: case OpCode::AddFloat: case OpCode::Concat: return OpCode::Add;
+	case OpCode::SubInt: case OpCode::SubFloat: return OpCode::Sub;
+	case OpCode::MulInt: case OpCode::MulFloat: return OpCode::Mul;
+	case OpCode::DivInt: case OpCode::DivFloat: return OpCode::Div;
+	case OpCode::IsEqualInt: case OpCode::IsEqualFloat: case OpCode::IsEqualString: case OpCode::IsEqualBool: return OpCode::IsEqual;
+	case OpCode::IsNotEqualInt: case OpCode::IsNotEqualFloat: case OpCode::IsNotEqualString: case OpCode::IsNotEqualBool: return OpCode::IsNotEqual;
+	case OpCode::IsLessInt: case OpCode::IsLessFloat: return OpCode::IsLess;
+	case OpCode::IsLessEqualInt: case OpCode::IsLessEqualFloat: return OpCode::IsLessEqual;
+	default: return op;
+	}
+}
+
+inline uint64_t valueBits(const Value& v) {
+	uint64_t bits;
+	std::memcpy(&bits, &v.i, sizeof(bits));
+	return v.type == TokenKind::True || v.type == TokenKind::False ? 0 : bits;
+}
+
+inline void assemble(CompiledExpr& expr) {
+	expr.constants.clear();
+	expr.functions.clear();
+	expr.code.clear();
+	expr.maxDepth = 0;
+	expr.temporaries = 0;
+	// A linear search suits the usual handful of constants; generated rules
+	// with thousands switch to a map.
+	std::map<std::pair<TokenKind, uint64_t>, int> constantIndex;
+	auto constant = [&](const Value& value) {
+		int index = expr.constants.size();
+		if (index < 64) {
+			auto same = [&](const Value& v) { return v.type == value.type && valueBits(v) == valueBits(value); };
+			index = std::find_if(expr.constants.begin(), expr.constants.end(), same) - expr.constants.begin();
+		}
+		else {
+			if (constantIndex.empty()) {
+				for (int k = 0; k < expr.constants.size(); k++) constantIndex.emplace(std::pair(expr.constants[k].type, valueBits(expr.constants[k])), k);
+			}
+			index = constantIndex.emplace(std::pair(value.type, valueBits(value)), index).first->second;
+		}
+		if (index == expr.constants.size()) expr.constants.push_back(value);
+		return index;
+	};
+	struct Operand { int reg; int start; TokenKind type; };
+	std::vector<Operand> stack;
+	std::vector<Bytecode>& code = expr.code;
+	auto temp = [&](int depth) {
+		expr.temporaries = std::max(expr.temporaries, depth + 1);
+		return depth;
+	};
+	auto emit = [&](OpCode op, int a, int b = 0, int c = 0) {
+		code.push_back({ op, static_cast<uint16_t>(a), static_cast<uint16_t>(b), static_cast<uint16_t>(c) });
+	};
+	// Constants and slots past the 14-bit register index are loaded into the
+	// temporary at the operand's depth.
+	auto operand = [&](RegisterSpace space, int index, int depth) {
+		if (index <= RegisterSpace::RegisterIndex) return space | index;
+		int dst = temp(depth);
+		code.push_back({ space == RegisterSpace::Constant ? OpCode::LoadConstant : OpCode::LoadSlot, static_cast<uint16_t>(dst) });
+		code.back().setOffset(index);
+		return dst;
+	};
+	// Int constants are promoted here; anything else is converted into the
+	// temporary at the operand's own depth.
+	auto promote = [&](int reg, int depth) {
+		if ((reg & ~RegisterSpace::RegisterIndex) == RegisterSpace::Constant) {
+			int index = constant(Value::fromFloat(static_cast<double>(expr.constants[reg & RegisterSpace::RegisterIndex].i)));
+			return operand(RegisterSpace::Constant, index, depth);
+		}
+		int dst = temp(depth);
+		emit(OpCode::IntToFloat, dst, reg);
+		return dst;
+	};
+	std::vector<TokenKind> types;
+	for (int i = 0; i < expr.program.size(); i++) {
+		const Instr& instr = expr.program[i];
+		expr.maxDepth = std::max<int>(expr.maxDepth, stack.size() + 1);
+		int count = operandCount(instr);
+		types.clear();
+		for (int k = stack.size() - count; k < stack.size(); k++) types.push_back(stack[k].type);
+		TokenKind type = inferType(instr, types.data(), nullptr);
+		switch (instr.op) {
+		case TokenKind::Int: case TokenKind::Float: case TokenKind::String: case TokenKind::True: case TokenKind::False:
+		case TokenKind::Variable: {
+			int start = code.size();
+			int reg = instr.op == TokenKind::Variable ? operand(RegisterSpace::Slot, instr.operand, stack.size())
+				: operand(RegisterSpace::Constant, constant(instr.value), stack.size());
+			if (instr.op == TokenKind::Variable) type = expr.types.empty() ? TokenKind::Unknown : expr.types[instr.operand];
+			stack.push_back({ reg, start, type });
+			break;
+		}
+		case TokenKind::Negative: case TokenKind::Not: {
+			Operand operand = stack.back(); stack.pop_back();
+			int dst = temp(stack.size());
+			OpCode op = opcodeFor(instr.op);
+			if (op == OpCode::Negative && operand.type == TokenKind::Int) op = OpCode::NegativeInt;
+			if (op == OpCode::Negative && operand.type == TokenKind::Float) op = OpCode::NegativeFloat;
+			emit(op, dst, operand.reg);
+			stack.push_back({ dst, operand.start, type });
+			break;
+		}
+		case TokenKind::Function: {
+			int arity = instr.function->arity;
+			int depth = stack.size() - arity;
+			int start = arity ? stack[depth].start : code.size();
+			for (int k = 0; k < arity; k++) {
+				int reg = temp(depth + k);
+				if (stack[depth + k].reg != reg) emit(OpCode::Move, reg, stack[depth + k].reg);
+			}
+			stack.resize(depth);
+			int index = std::find(expr.functions.begin(), expr.functions.end(), instr.function) - expr.functions.begin();
+			if (index == expr.functions.size()) expr.functions.push_back(instr.function);
+			int dst = temp(depth);
+			emit(OpCode::Call, dst, 0, index);
+			stack.push_back({ dst, start, type });
+			break;
+		}
+		case TokenKind::And: case TokenKind::Or: {
+			Operand right = stack.back(); stack.pop_back();
+			Operand left = stack.back(); stack.pop_back();
+			int dst = temp(stack.size());
+			Bytecode guard[2] = { { OpCode::Move, static_cast<uint16_t>(dst), static_cast<uint16_t>(left.reg) } };
+			int moves = left.reg != dst;
+			guard[moves] = { instr.op == TokenKind::Or ? OpCode::JumpIfTrue : OpCode::JumpIfFalse, static_cast<uint16_t>(dst) };
+			guard[moves].setOffset(code.size() - right.start + 1);
+			code.insert(code.begin() + right.start, guard, guard + moves + 1);
+			emit(opcodeFor(instr.op), dst, dst, right.reg);
+			stack.push_back({ dst, left.start, type });
+			break;
+		}
+		default: {
+			Operand right = stack.back(); stack.pop_back();
+			Operand left = stack.back(); stack.pop_back();
+			int dst = temp(stack.size());
+			OpCode op = typedOpcode(instr.op, left.type, right.type);
+			if (op != opcodeFor(instr.op)) {
+				if (left.type == TokenKind::Int && right.type == TokenKind::Float) left.reg = promote(left.reg, dst);
+				if (right.type == TokenKind::Int && left.type == TokenKind::Float) right.reg = promote(right.reg, dst + 1);
+				if (instr.op == TokenKind::IsGreat || instr.op == TokenKind::IsGreatEqual) std::swap(left.reg, right.reg);
+			}
+			emit(op, dst, left.reg, right.reg);
+			stack.push_back({ dst, left.start, type });
+			break;
+		}
+		}
+	}
+	if (stack.empty()) return;
+	emit(OpCode::Return, stack.back().reg);
+	// Temporaries have no wide form; callers report the empty code.
+	if (expr.temporaries > RegisterSpace::RegisterIndex) {
+		code.clear();
+		return;
+	}
+	for (int i = code.size() - 1; i >= 0; i--) {
+		Bytecode& jump = code[i];
+		if (jump.op != OpCode::JumpIfTrue && jump.op != OpCode::JumpIfFalse) continue;
+		size_t target = i + jump.offset() + 1;
+		if (target < code.size() && code[target].op == jump.op && code[target].a == jump.a) {
+			jump.setOffset(jump.offset() + code[target].offset() + 1);
+		}
+	}
+}
+
+const int LocalFrame = 32;
+
+// A temporary string on the left is owned by its register alone, so a chain
+// of + appends into one buffer instead of copying the prefix.
+inline Value concatenate(const Value& x, const Value& y, std::forward_list<std::wstring>& temps) {
+	if (!temps.empty() && x.s == &temps.front()) temps.front() += *y.s;
+	else temps.emplace_front(*x.s + *y.s);
+	return Value::fromString(&temps.front());
+}
+
+#if defined(__GNUC__)
+#define CPP_EVAL_COMPUTED_GOTO 1
+#endif
+
+inline Value CompiledExpr::execute(const Value* slots, std::forward_list<std::wstring>& temps) const {
+	if (code.empty()) {
+		std::cerr << "FATAL ERROR!\n";
+		assert(false);
+		return {};
+	}
+	// Uninitialized storage: every temporary is written before it is read.
+	alignas(Value) unsigned char local[LocalFrame * sizeof(Value)];
+	std::vector<Value> heap;
+	Value* frame = reinterpret_cast<Value*>(local);
+	if (temporaries > LocalFrame) {
+		heap.resize(temporaries);
+		frame = heap.data();
+	}
+	const Value* const spaces[] = { frame, slots, constants.data() };
+#define VM_REG(r) spaces[(r) >> 14][(r) & RegisterSpace::RegisterIndex]
+// An Unknown operand, such as an unbound variable, makes the result Unknown:
+// every operation but the short-circuit jumps would pass it on anyway.
+#define VM_KNOWN(r) if (VM_REG(r).type == TokenKind::Unknown) return {}
+#if CPP_EVAL_PROFILE
+	CPP_EVAL_PROFILE_SCOPE(ProfilePhase::Execute, profile);
+	// Constant folding inside compile is not counted as executed opcodes.
+	std::atomic<uint64_t>* profileOps = profileScope.outermost() ? profileCounters().ops : nullptr;
+#define VM_COUNT(name) if (profileOps) profileBump(profileOps[static_cast<int>(OpCode::name)])
+#else
+#define VM_COUNT(name)
+#endif
+	const Bytecode* pc = code.data();
+#if CPP_EVAL_COMPUTED_GOTO
+	static const void* const dispatch[] = {
+		&&op_Move, &&op_Negative, &&op_Not,
+		&&op_Add, &&op_Sub, &&op_Mul, &&op_Div,
+		&&op_IsEqual, &&op_IsNotEqual, &&op_IsGreat, &&op_IsLess, &&op_IsGreatEqual, &&op_IsLessEqual,
+		&&op_And, &&op_Or, &&op_Call, &&op_JumpIfTrue, &&op_JumpIfFalse,
+		&&op_NegativeInt, &&op_NegativeFloat,
+		&&op_AddInt, &&op_SubInt, &&op_MulInt, &&op_DivInt,
+		&&op_AddFloat, &&op_SubFloat, &&op_MulFloat, &&op_DivFloat,
+		&&op_Concat,
+		&&op_IsEqualInt, &&op_IsNotEqualInt, &&op_IsLessInt, &&op_IsLessEqualInt,
+		&&op_IsEqualFloat, &&op_IsNotEqualFloat, &&op_IsLessFloat, &&op_IsLessEqualFloat,
+		&&op_IsEqualString, &&op_IsNotEqualString, &&op_IsEqualBool, &&op_IsNotEqualBool,
+		&&op_IntToFloat, &&op_LoadConstant, &&op_LoadSlot, &&op_Return,
+	};
+#define VM_CASE(name) op_##name: VM_COUNT(name);
+#define VM_NEXT() goto *dispatch[static_cast<int>((++pc)->op)]
+	goto *dispatch[static_cast<int>(pc->op)];
+#else
+#define VM_CASE(name) case OpCode::name: VM_COUNT(name);
+#define VM_NEXT() ++pc; continue
+	for (;;) switch (pc->op) {
+#endif
+	VM_CASE(Move)
+		frame[pc->a] = VM_REG(pc->b);
+		VM_NEXT();
+	VM_CASE(Negative) {
+		VM_KNOWN(pc->b);
+		const Value& x = VM_REG(pc->b);
+		if (x.type == TokenKind::Int) frame[pc->a] = Value::fromInt(negateInt(x.i));
+		else if (x.type == TokenKind::Float) frame[pc->a] = Value::fromFloat(-x.f);
+		else {
+			assert(false);
+			frame[pc->a] = Value();
+		}
+		VM_NEXT();
+	}
+	VM_CASE(Not)
+		VM_KNOWN(pc->b);
+		if (!isBool(VM_REG(pc->b))) assert(false);
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).type == TokenKind::False);
+		VM_NEXT();
+	VM_CASE(Add) {
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		const Value& x = VM_REG(pc->b);
+		const Value& y = VM_REG(pc->c);
+		if (x.type == TokenKind::String && y.type == TokenKind::String) frame[pc->a] = concatenate(x, y, temps);
+		else frame[pc->a] = arithmetic(x, y, [](auto a, auto b) { return a + b; });
+		VM_NEXT();
+	}
+	VM_CASE(Sub)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		frame[pc->a] = arithmetic(VM_REG(pc->b), VM_REG(pc->c), [](auto a, auto b) { return a - b; });
+		VM_NEXT();
+	VM_CASE(Mul)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		frame[pc->a] = arithmetic(VM_REG(pc->b), VM_REG(pc->c), [](auto a, auto b) { return a * b; });
+		VM_NEXT();
+	VM_CASE(Div) {
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		const Value& x = VM_REG(pc->b);
+		const Value& y = VM_REG(pc->c);
+		if (x.type == TokenKind::Int && y.type == TokenKind::Int) {
+			if (y.i == 0) return {};
+			frame[pc->a] = Value::fromInt(divideInt(x.i, y.i));
+		}
+		else frame[pc->a] = arithmetic(x, y, [](auto a, auto b) { return a / b; });
+		VM_NEXT();
+	}
+	VM_CASE(IsEqual)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		frame[pc->a] = Value::fromBool(equals(VM_REG(pc->b), VM_REG(pc->c)));
+		VM_NEXT();
+	VM_CASE(IsNotEqual)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		frame[pc->a] = Value::fromBool(!equals(VM_REG(pc->b), VM_REG(pc->c)));
+		VM_NEXT();
+	VM_CASE(IsGreat)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		frame[pc->a] = compare(VM_REG(pc->b), VM_REG(pc->c), [](auto a, auto b) { return a > b; });
+		VM_NEXT();
+	VM_CASE(IsLess)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		frame[pc->a] = compare(VM_REG(pc->b), VM_REG(pc->c), [](auto a, auto b) { return a < b; });
+		VM_NEXT();
+	VM_CASE(IsGreatEqual)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		frame[pc->a] = compare(VM_REG(pc->b), VM_REG(pc->c), [](auto a, auto b) { return a >= b; });
+		VM_NEXT();
+	VM_CASE(IsLessEqual)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		frame[pc->a] = compare(VM_REG(pc->b), VM_REG(pc->c), [](auto a, auto b) { return a <= b; });
+		VM_NEXT();
+	VM_CASE(And)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		if (!isBool(VM_REG(pc->b)) || !isBool(VM_REG(pc->c))) assert(false);
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).type == TokenKind::True && VM_REG(pc->c).type == TokenKind::True);
+		VM_NEXT();
+	VM_CASE(Or)
+		VM_KNOWN(pc->b);
+		VM_KNOWN(pc->c);
+		if (!isBool(VM_REG(pc->b)) || !isBool(VM_REG(pc->c))) assert(false);
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).type == TokenKind::True || VM_REG(pc->c).type == TokenKind::True);
+		VM_NEXT();
+	VM_CASE(Call) {
+		const NativeFunction& fn = *functions[pc->c];
+		frame[pc->a] = fn.call(fn.target.get(), frame + pc->a, temps);
+		VM_NEXT();
+	}
+	VM_CASE(JumpIfTrue)
+		VM_KNOWN(pc->a);
+		if (!isBool(frame[pc->a])) assert(false);
+		if (frame[pc->a].type == TokenKind::True) pc += pc->offset();
+		VM_NEXT();
+	VM_CASE(JumpIfFalse)
+		VM_KNOWN(pc->a);
+		if (!isBool(frame[pc->a])) assert(false);
+		if (frame[pc->a].type == TokenKind::False) pc += pc->offset();
+		VM_NEXT();
+	VM_CASE(NegativeInt)
+		frame[pc->a] = Value::fromInt(negateInt(VM_REG(pc->b).i));
+		VM_NEXT();
+	VM_CASE(NegativeFloat)
+		frame[pc->a] = Value::fromFloat(-VM_REG(pc->b).f);
+		VM_NEXT();
+	VM_CASE(AddInt)
+		frame[pc->a] = Value::fromInt(static_cast<int64_t>(static_cast<uint64_t>(VM_REG(pc->b).i) + static_cast<uint64_t>(VM_REG(pc->c).i)));
+		VM_NEXT();
+	VM_CASE(SubInt)
+		frame[pc->a] = Value::fromInt(static_cast<int64_t>(static_cast<uint64_t>(VM_REG(pc->b).i) - static_cast<uint64_t>(VM_REG(pc->c).i)));
+		VM_NEXT();
+	VM_CASE(MulInt)
+		frame[pc->a] = Value::fromInt(static_cast<int64_t>(static_cast<uint64_t>(VM_REG(pc->b).i) * static_cast<uint64_t>(VM_REG(pc->c).i)));
+		VM_NEXT();
+	VM_CASE(DivInt)
+		if (VM_REG(pc->c).i == 0) return {};
+		frame[pc->a] = Value::fromInt(divideInt(VM_REG(pc->b).i, VM_REG(pc->c).i));
+		VM_NEXT();
+	VM_CASE(AddFloat)
+		frame[pc->a] = Value::fromFloat(VM_REG(pc->b).f + VM_REG(pc->c).f);
+		VM_NEXT();
+	VM_CASE(SubFloat)
+		frame[pc->a] = Value::fromFloat(VM_REG(pc->b).f - VM_REG(pc->c).f);
+		VM_NEXT();
+	VM_CASE(MulFloat)
+		frame[pc->a] = Value::fromFloat(VM_REG(pc->b).f * VM_REG(pc->c).f);
+		VM_NEXT();
+	VM_CASE(DivFloat)
+		frame[pc->a] = Value::fromFloat(VM_REG(pc->b).f / VM_REG(pc->c).f);
+		VM_NEXT();
+	VM_CASE(Concat)
+		frame[pc->a] = concatenate(VM_REG(pc->b), VM_REG(pc->c), temps);
+		VM_NEXT();
+	VM_CASE(IsEqualInt)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).i == VM_REG(pc->c).i);
+		VM_NEXT();
+	VM_CASE(IsNotEqualInt)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).i != VM_REG(pc->c).i);
+		VM_NEXT();
+	VM_CASE(IsLessInt)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).i < VM_REG(pc->c).i);
+		VM_NEXT();
+	VM_CASE(IsLessEqualInt)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).i <= VM_REG(pc->c).i);
+		VM_NEXT();
+	VM_CASE(IsEqualFloat)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).f == VM_REG(pc->c).f);
+		VM_NEXT();
+	VM_CASE(IsNotEqualFloat)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).f != VM_REG(pc->c).f);
+		VM_NEXT();
+	VM_CASE(IsLessFloat)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).f < VM_REG(pc->c).f);
+		VM_NEXT();
+	VM_CASE(IsLessEqualFloat)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).f <= VM_REG(pc->c).f);
+		VM_NEXT();
+	VM_CASE(IsEqualString)
+		frame[pc->a] = Value::fromBool(equalStrings(VM_REG(pc->b), VM_REG(pc->c)));
+		VM_NEXT();
+	VM_CASE(IsNotEqualString)
+		frame[pc->a] = Value::fromBool(!equalStrings(VM_REG(pc->b), VM_REG(pc->c)));
+		VM_NEXT();
+	VM_CASE(IsEqualBool)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).type == VM_REG(pc->c).type);
+		VM_NEXT();
+	VM_CASE(IsNotEqualBool)
+		frame[pc->a] = Value::fromBool(VM_REG(pc->b).type != VM_REG(pc->c).type);
+		VM_NEXT();
+	VM_CASE(IntToFloat)
+		frame[pc->a] = Value::fromFloat(static_cast<double>(VM_REG(pc->b).i));
+		VM_NEXT();
+	VM_CASE(LoadConstant)
+		frame[pc->a] = constants[pc->offset()];
+		VM_NEXT();
+	VM_CASE(LoadSlot)
+		frame[pc->a] = slots[pc->offset()];
+		VM_NEXT();
+	VM_CASE(Return)
+		return VM_REG(pc->a);
+#if !CPP_EVAL_COMPUTED_GOTO
+	}
+#endif
+#undef VM_CASE
+#undef VM_NEXT
+#undef VM_REG
+#undef VM_KNOWN
+#undef VM_COUNT
+}
+
+inline bool isLiteral(const Instr& instr) {
+	return instr.op == TokenKind::Int || instr.op == TokenKind::Float || instr.op == TokenKind::String
+		|| instr.op == TokenKind::True || instr.op == TokenKind::False;
+}
+
+inline bool isIntLiteral(const Instr& instr, int64_t v) {
+	return instr.op == TokenKind::Int && instr.value.i == v;
+}
+
+inline bool canFold(const Instr& instr, const Instr* args, int count) {
+	const Value& a = args[0].value;
+	const Value& b = args[count - 1].value;
+	switch (instr.op) {
+	case TokenKind::Function: {
+		const NativeFunction& fn = *instr.function;
+		for (int i = 0; i < count; i++) {
+			if (!accepts(fn.parameters[i], args[i].value)) return false;
+		}
+		return true;
+	}
+	case TokenKind::Negative: return isNumber(a);
+	case TokenKind::Not: return isBool(a);
+	case TokenKind::Add: return (isNumber(a) && isNumber(b)) || (a.type == TokenKind::String && b.type == TokenKind::String);
+	case TokenKind::Sub: case TokenKind::Mul: return isNumber(a) && isNumber(b);
+	case TokenKind::Div: return isNumber(a) && isNumber(b) && !(a.type == TokenKind::Int && b.type == TokenKind::Int && b.i == 0);
+	case TokenKind::IsEqual: case TokenKind::IsNotEqual:
+		return (isNumber(a) && isNumber(b)) || (a.type == TokenKind::String && b.type == TokenKind::String) || (isBool(a) && isBool(b));
+	case TokenKind::IsGreat: case TokenKind::IsLess: case TokenKind::IsGreatEqual: case TokenKind::IsLessEqual:
+		return isNumber(a) && isNumber(b);
+	case TokenKind::And: case TokenKind::Or: return isBool(a) && isBool(b);
+	default: return false;
+	}
+}
+
+// Identities are only dropped where the operand left in place is known to
+// have the type the operation requires, so x + 0 with an undeclared x still
+// fails for a String as it would without the rewrite.
+inline std::vector<Instr> optimize(const std::vector<Instr>& program) {
+	std::vector<Instr> out;
+	// The static type of the subexpression ending at each instruction of out.
+	std::vector<TokenKind> types;
+	std::vector<int> starts;
+	std::vector<TokenKind> args;
+	for (int i = 0; i < program.size(); i++) {
+		const Instr& instr = program[i];
+		int count = operandCount(instr);
+		if (count == 0) {
+			starts.push_back(out.size());
+			out.push_back(instr);
+			types.push_back(inferType(instr, nullptr, nullptr));
+			continue;
+		}
+		int startB = starts[starts.size() - 1];
+		int startA = starts[starts.size() - count];
+		args.clear();
+		for (int k = 1; k <= count; k++) {
+			int end = k < count ? starts[starts.size() - count + k] : out.size();
+			args.push_back(types[end - 1]);
+		}
+		starts.resize(starts.size() - count + 1);
+		TokenKind type = inferType(instr, args.data(), nullptr);
+		auto number = [](TokenKind t) { return t == TokenKind::Int || t == TokenKind::Float; };
+		bool numberA = number(args[0]), numberB = number(args[count - 1]);
+		bool boolA = args[0] == TokenKind::True, boolB = args[count - 1] == TokenKind::True;
+		bool singleA = (count == 1 ? out.size() : startB) - startA == 1;
+		bool singleB = out.size() - startB == 1;
+		bool constant = out.size() - startA == count && std::all_of(out.begin() + startA, out.end(), isLiteral);
+		if (constant && canFold(instr, &out[startA], count)) {
+			CompiledExpr folded;
+			folded.program.assign(out.begin() + startA, out.end());
+			folded.program.push_back(instr);
+			assemble(folded);
+			std::forward_list<std::wstring> temps;
+			Value v = folded.execute(nullptr, temps);
+			// Unknown has no literal, so a call giving it is left in place.
+			if (v.type != TokenKind::Unknown) {
+				if (v.type == TokenKind::String) v = literalString(*v.s);
+				out.resize(startA);
+				types.resize(startA);
+				out.push_back({ v.type, v });
+				types.push_back(typeOf(v));
+				continue;
+			}
+		}
+		const Instr& a = out[startA];
+		const Instr& b = out[startB];
+		auto dropB = [&]() { out.pop_back(); types.pop_back(); };
+		auto dropA = [&]() { out.erase(out.begin() + startA); types.erase(types.begin() + startA); };
+		switch (instr.op) {
+		case TokenKind::Negative: case TokenKind::Not: {
+			// - -x is x for a number and not not x is x for a Bool.
+			bool twice = out.back().op == instr.op && out.size() - startA > 1;
+			TokenKind inner = twice ? types[out.size() - 2] : TokenKind::Unknown;
+			if (twice && (instr.op == TokenKind::Negative ? number(inner) : inner == TokenKind::True)) { dropB(); continue; }
+			break;
+		}
+		case TokenKind::Add:
+			if (singleB && isIntLiteral(b, 0) && numberA) { dropB(); continue; }
+			if (singleA && isIntLiteral(a, 0) && numberB) { dropA(); continue; }
+			break;
+		case TokenKind::Sub:
+			if (singleB && isIntLiteral(b, 0) && numberA) { dropB(); continue; }
+			break;
+		case TokenKind::Mul:
+			if (singleB && isIntLiteral(b, 1) && numberA) { dropB(); continue; }
+			if (singleA && isIntLiteral(a, 1) && numberB) { dropA(); continue; }
+			break;
+		case TokenKind::Div:
+			if (singleB && isIntLiteral(b, 1) && numberA) { dropB(); continue; }
+			break;
+		case TokenKind::And: case TokenKind::Or: {
+			TokenKind identity = instr.op == TokenKind::And ? TokenKind::True : TokenKind::False;
+			TokenKind absorbing = instr.op == TokenKind::And ? TokenKind::False : TokenKind::True;
+			// An absorbing left side skips the right one at run time too; in
+			// front of an absorbing right side the left one must be a Bool.
+			if ((singleA && a.op == absorbing) || (singleB && b.op == absorbing && boolA)) {
+				out.resize(startA);
+				types.resize(startA);
+				out.push_back({ absorbing, Value::fromBool(absorbing == TokenKind::True) });
+				types.push_back(TokenKind::True);
+				continue;
+			}
+			if (singleB && b.op == identity && boolA) { dropB(); continue; }
+			if (singleA && a.op == identity && boolB) { dropA(); continue; }
+			break;
+		}
+		}
+		out.push_back(instr);
+		types.push_back(type);
+	}
+	return out;
+}
+
+inline Token CompiledExpr::run() const {
+	std::vector<Value> slots(variables.size());
+	return run(slots);
+}
+
+inline Token CompiledExpr::run(const std::vector<Value>& slots) const {
+	if (program.empty()) return { TokenKind::Unknown, L"" };
+	assert(slots.size() >= variables.size());
+	assert(std::equal(types.begin(), types.end(), slots.begin(), [](TokenKind type, const Value& v) { return type == TokenKind::Unknown || type == typeOf(v); }));
+	std::forward_list<std::wstring> temps;
+	return execute(slots.data(), temps).toToken();
+}
+
+inline Token CompiledExpr::run(const std::map<std::wstring, Value>& bindings) const {
+	std::vector<Value> slots(variables.size());
+	for (int i = 0; i < variables.size(); i++) {
+		auto it = bindings.find(variables[i]);
+		if (it != bindings.end()) slots[i] = it->second;
+	}
+	return run(slots);
+}
+
+const int BatchChunk = 256;
+
+template <typename Op>
+inline void batchUnary(double* a, int n, Op op) {
+	for (int i = 0; i < n; i++) a[i] = op(a[i]);
+}
+
+template <typename Op>
+inline void batchBinary(double* a, const double* b, int n, Op op) {
+	for (int i = 0; i < n; i++) a[i] = op(a[i], b[i]);
+}
+
+// Columns are read as the declared slot types, Float where none is declared.
+// Int division by zero gives inf or nan here, where run() gives Unknown.
+// Returns false, with out partly written, if the program failed to compile
+// or a value is not a number or Bool.
+inline bool CompiledExpr::runBatch(std::span<const std::span<const double>> columns, std::span<double> out) const {
+	CPP_EVAL_PROFILE_SCOPE(ProfilePhase::Execute);
+	assert(columns.size() >= variables.size());
+	if (program.empty()) return false;
+	auto columnType = [&](int slot) { return types.empty() || types[slot] == TokenKind::Unknown ? TokenKind::Float : types[slot]; };
+	std::vector<double> constants(program.size());
+	for (int i = 0; i < program.size(); i++) {
+		const Value& v = program[i].value;
+		switch (program[i].op) {
+		case TokenKind::Int: case TokenKind::Float: constants[i] = toDouble(v); break;
+		case TokenKind::True: constants[i] = 1.0; break;
+		case TokenKind::False: constants[i] = 0.0; break;
+		case TokenKind::String: return false;
+		default: break;
+		}
+	}
+	std::vector<double> registers(std::max(maxDepth, 1) * BatchChunk);
+	std::vector<TokenKind> stackTypes(std::max(maxDepth, 1));
+	std::vector<const double*> arguments;
+	for (int begin = 0; begin < out.size(); begin += BatchChunk) {
+		int n = std::min<int>(BatchChunk, out.size() - begin);
+		int depth = 0;
+		// Set when a function returning Value gives different types across rows.
+		bool mixed = false;
+		for (int i = 0; i < program.size() && !mixed; i++) {
+			TokenKind op = program[i].op;
+			int top = std::max(depth - 1, 0), below = std::max(depth - 2, 0);
+			double* a = registers.data() + below * BatchChunk;
+			double* b = registers.data() + top * BatchChunk;
+			TokenKind& typeA = stackTypes[below];
+			TokenKind typeB = stackTypes[top];
+			switch (op) {
+			case TokenKind::Int: case TokenKind::Float: case TokenKind::True: case TokenKind::False:
+				std::fill_n(&registers[depth * BatchChunk], n, constants[i]);
+				stackTypes[depth++] = op == TokenKind::False ? TokenKind::True : op;
+				break;
+			case TokenKind::Variable:
+				assert(columns[program[i].operand].size() >= out.size());
+				if (columnType(program[i].operand) == TokenKind::String) return false;
+				std::copy_n(columns[program[i].operand].data() + begin, n, &registers[depth * BatchChunk]);
+				stackTypes[depth++] = columnType(program[i].operand);
+				break;
+			case TokenKind::Negative:
+				if (typeB != TokenKind::Int && typeB != TokenKind::Float) return false;
+				batchUnary(b, n, [](double x) { return -x; });
+				break;
+			case TokenKind::Not:
+				if (typeB != TokenKind::True) return false;
+				batchUnary(b, n, [](double x) { return 1.0 - x; });
+				break;
+			case TokenKind::Function: {
+				const NativeFunction& fn = *program[i].function;
+				int base = depth - fn.arity;
+				double* result = registers.data() + base * BatchChunk;
+				arguments.clear();
+				for (int k = 0; k < fn.arity; k++) {
+					if (fn.parameters[k] == TokenKind::Float && stackTypes[base + k] != TokenKind::Int && stackTypes[base + k] != TokenKind::Float) return false;
+					if (fn.parameters[k] != TokenKind::Float && fn.parameters[k] != TokenKind::Unknown && fn.parameters[k] != stackTypes[base + k]) return false;
+					arguments.push_back(registers.data() + (base + k) * BatchChunk);
+				}
+				if (fn.batch) {
+					fn.batch(fn.target.get(), arguments.data(), result, n);
+					stackTypes[base] = fn.result;
+				}
+				else {
+					std::vector<Value> args(fn.arity);
+					std::forward_list<std::wstring> temps;
+					// stackTypes[base] is the first argument's type until every row is done.
+					TokenKind resultType = TokenKind::Unknown;
+					for (int row = 0; row < n; row++) {
+						for (int k = 0; k < fn.arity; k++) {
+							double x = arguments[k][row];
+							TokenKind type = stackTypes[base + k];
+							args[k] = type == TokenKind::Int ? Value::fromInt(x) : type == TokenKind::True ? Value::fromBool(x != 0.0) : Value::fromFloat(x);
+						}
+						Value v = fn.call(fn.target.get(), args.data(), temps);
+						if (!isNumber(v) && !isBool(v)) return false;
+						result[row] = isBool(v) ? (v.type == TokenKind::True ? 1.0 : 0.0) : toDouble(v);
+						TokenKind type = isBool(v) ? TokenKind::True : v.type;
+						if (row == 0) resultType = type;
+						else mixed = mixed || type != resultType;
+					}
+					stackTypes[base] = resultType;
+				}
+				depth = base + 1;
+				break;
+			}
+			case TokenKind::Add: case TokenKind::Sub: case TokenKind::Mul: case TokenKind::Div: {
+				if ((typeA != TokenKind::Int && typeA != TokenKind::Float) || (typeB != TokenKind::Int && typeB != TokenKind::Float)) return false;
+				bool integer = typeA == TokenKind::Int && typeB == TokenKind::Int;
+				if (op == TokenKind::Add) batchBinary(a, b, n, [](double x, double y) { return x + y; });
+				else if (op == TokenKind::Sub) batchBinary(a, b, n, [](double x, double y) { return x - y; });
+				else if (op == TokenKind::Mul) batchBinary(a, b, n, [](double x, double y) { return x * y; });
+				else if (integer) batchBinary(a, b, n, [](double x, double y) { return std::trunc(x / y); });
+				else batchBinary(a, b, n, [](double x, double y) { return x / y; });
+				typeA = integer ? TokenKind::Int : TokenKind::Float;
+				depth--;
+				break;
+			}
+			case TokenKind::IsEqual: case TokenKind::IsNotEqual:
+				if ((typeA == TokenKind::True) != (typeB == TokenKind::True)) return false;
+				if (op == TokenKind::IsEqual) batchBinary(a, b, n, [](double x, double y) { return x == y ? 1.0 : 0.0; });
+				else batchBinary(a, b, n, [](double x, double y) { return x != y ? 1.0 : 0.0; });
+				typeA = TokenKind::True;
+				depth--;
+				break;
+			case TokenKind::IsGreat: case TokenKind::IsLess: case TokenKind::IsGreatEqual: case TokenKind::IsLessEqual:
+				if ((typeA != TokenKind::Int && typeA != TokenKind::Float) || (typeB != TokenKind::Int && typeB != TokenKind::Float)) return false;
+				if (op == TokenKind::IsGreat) batchBinary(a, b, n, [](double x, double y) { return x > y ? 1.0 : 0.0; });
+				else if (op == TokenKind::IsLess) batchBinary(a, b, n, [](double x, double y) { return x < y ? 1.0 : 0.0; });
+				else if (op == TokenKind::IsGreatEqual) batchBinary(a, b, n, [](double x, double y) { return x >= y ? 1.0 : 0.0; });
+				else batchBinary(a, b, n, [](double x, double y) { return x <= y ? 1.0 : 0.0; });
+				typeA = TokenKind::True;
+				depth--;
+				break;
+			case TokenKind::And: case TokenKind::Or:
+				if (typeA != TokenKind::True || typeB != TokenKind::True) return false;
+				if (op == TokenKind::And) batchBinary(a, b, n, [](double x, double y) { return x * y; });
+				else batchBinary(a, b, n, [](double x, double y) { return x + y - x * y; });
+				depth--;
+				break;
+			default:
+				return false;
+			}
+		}
+		if (mixed) {
+			// Operations after the call would depend on each row's type, so the
+			// interpreter runs this chunk row by row.
+			std::vector<Value> slots(variables.size());
+			std::forward_list<std::wstring> temps;
+			for (int row = begin; row < begin + n; row++) {
+				for (int v = 0; v < variables.size(); v++) {
+					double x = columns[v][row];
+					TokenKind type = columnType(v);
+					slots[v] = type == TokenKind::Int ? Value::fromInt(x) : type == TokenKind::True ? Value::fromBool(x != 0.0) : Value::fromFloat(x);
+				}
+				Value result = execute(slots.data(), temps);
+				if (!isNumber(result) && !isBool(result)) return false;
+				out[row] = isBool(result) ? (result.type == TokenKind::True ? 1.0 : 0.0) : toDouble(result);
+				temps.clear();
+			}
+			continue;
+		}
+		std::copy_n(registers.data(), n, out.data() + begin);
+	}
+	return true;
+}
+
+inline Token eval(std::wstring src) {
+	return compile(src).run();
+}
+
+#if CPP_EVAL_PROFILE
+constexpr const char* opcodeName(OpCode op) {
+	switch (op) {
+	case OpCode::Move: return "Move";
+	case OpCode::Negative: return "Negative";
+	case OpCode::Not: return "Not";
+	case OpCode::Add: return "Add";
+	case OpCode::Sub: return "Sub";
+	case OpCode::Mul: return "Mul";
+	case OpCode::Div: return "Div";
+	case OpCode::IsEqual: return "IsEqual";
+	case OpCode::IsNotEqual: return "IsNotEqual";
+	case OpCode::IsGreat: return "IsGreat";
+	case OpCode::IsLess: return "IsLess";
+	case OpCode::IsGreatEqual: return "IsGreatEqual";
+	case OpCode::IsLessEqual: return "IsLessEqual";
+	case OpCode::And: return "And";
+	case OpCode::Or: return "Or";
+	case OpCode::Call: return "Call";
+	case OpCode::JumpIfTrue: return "JumpIfTrue";
+	case OpCode::JumpIfFalse: return "JumpIfFalse";
+	case OpCode::NegativeInt: return "NegativeInt";
+	case OpCode::NegativeFloat: return "NegativeFloat";
+	case OpCode::AddInt: return "AddInt";
+	case OpCode::SubInt: return "SubInt";
+	case OpCode::MulInt: return "MulInt";
+	case OpCode::DivInt: return "DivInt";
+	case OpCode::AddFloat: return "AddFloat";
+	case OpCode::SubFloat: return "SubFloat";
+	case OpCode::MulFloat: return "MulFloat";
+	case OpCode::DivFloat: return "DivFloat";
+	case OpCode::Concat: return "Concat";
+	case OpCode::IsEqualInt: return "IsEqualInt";
+	case OpCode::IsNotEqualInt: return "IsNotEqualInt";
+	case OpCode::IsLessInt: return "IsLessInt";
+	case OpCode::IsLessEqualInt: return "IsLessEqualInt";
+	case OpCode::IsEqualFloat: return "IsEqualFloat";
+	case OpCode::IsNotEqualFloat: return "IsNotEqualFloat";
+	case OpCode::IsLessFloat: return "IsLessFloat";
+	case OpCode::IsLessEqualFloat: return "IsLessEqualFloat";
+	case OpCode::IsEqualString: return "IsEqualString";
+	case OpCode::IsNotEqualString: return "IsNotEqualString";
+	case OpCode::IsEqualBool: return "IsEqualBool";
+	case OpCode::IsNotEqualBool: return "IsNotEqualBool";
+	case OpCode::IntToFloat: return "IntToFloat";
+	case OpCode::LoadConstant: return "LoadConstant";
+	case OpCode::LoadSlot: return "LoadSlot";
+	case OpCode::Return: return "Return";
+	}
+	return "Unknown";
+}
+
+static_assert(static_cast<int>(OpCode::Return) < ProfileOps);
+
+struct ProfileReport {
+	struct Phase {
+		uint64_t calls = 0;
+		uint64_t ns = 0;
+		uint64_t allocations = 0;
+	};
+
+	struct Expression {
+		std::wstring source;
+		uint64_t runs = 0;
+		uint64_t ns = 0;
+		uint64_t buckets[LatencyBuckets] = {};
+
+		// Upper bound of the bucket holding quantile q of the runs.
+		uint64_t percentile(double q) const {
+			uint64_t seen = 0;
+			for (int k = 0; k < LatencyBuckets; k++) {
+				seen += buckets[k];
+				if (seen > 0 && seen >= q * runs) return uint64_t(1) << k;
+			}
+			return 0;
+		}
+	};
+
+	Phase phases[static_cast<int>(ProfilePhase::Count)];
+	uint64_t ops[ProfileOps] = {};
+	// Slowest total time first.
+	std::vector<Expression> expressions;
+
+	void print(std::wostream& out, int topExpressions = 10) const {
+		const wchar_t* names[] = { L"tokenize", L"compile", L"execute" };
+		for (int i = 0; i < std::size(names); i++) {
+			const Phase& phase = phases[i];
+			out << names[i] << L": " << phase.calls << L" calls, " << phase.ns << L" ns, "
+				<< (phase.calls ? phase.ns / phase.calls : 0) << L" ns/call, " << phase.allocations << L" allocations\n";
+		}
+		for (int i = 0; i <= static_cast<int>(OpCode::Return); i++) {
+			if (ops[i]) out << L"  " << opcodeName(static_cast<OpCode>(i)) << L": " << ops[i] << L"\n";
+		}
+		for (int i = 0; i < expressions.size() && i < topExpressions; i++) {
+			const Expression& e = expressions[i];
+			out << e.runs << L" runs, " << e.ns / std::max<uint64_t>(e.runs, 1) << L" ns avg, p50 < " << e.percentile(0.5)
+				<< L" ns, p99 < " << e.percentile(0.99) << L" ns: " << e.source << L"\n";
+		}
+	}
+};
+
+inline ProfileReport profileReport() {
+	ProfileReport report;
+	ProfileRegistry& registry = profileRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (const std::unique_ptr<ProfileCounters>& counters : registry.threads) {
+		for (int i = 0; i < static_cast<int>(ProfilePhase::Count); i++) {
+			report.phases[i].calls += counters->calls[i].load(std::memory_order_relaxed);
+			report.phases[i].ns += counters->ns[i].load(std::memory_order_relaxed);
+			report.phases[i].allocations += counters->allocations[i].load(std::memory_order_relaxed);
+		}
+		for (int i = 0; i < ProfileOps; i++) report.ops[i] += counters->ops[i].load(std::memory_order_relaxed);
+	}
+	for (const auto& [source, profile] : registry.expressions) {
+		ProfileReport::Expression e;
+		e.source = source;
+		e.runs = profile->runs.load(std::memory_order_relaxed);
+		e.ns = profile->ns.load(std::memory_order_relaxed);
+		for (int k = 0; k < LatencyBuckets; k++) e.buckets[k] = profile->buckets[k].load(std::memory_order_relaxed);
+		if (e.runs) report.expressions.push_back(std::move(e));
+	}
+	std::sort(report.expressions.begin(), report.expressions.end(), [](const auto& a, const auto& b) { return a.ns > b.ns; });
+	return report;
+}
+
+// Clears all counters; expressions compiled earlier keep reporting.
+inline void profileReset() {
+	ProfileRegistry& registry = profileRegistry();
+	std::lock_guard<std::mutex> lock(registry.mutex);
+	for (const std::unique_ptr<ProfileCounters>& counters : registry.threads) {
+		for (int i = 0; i < static_cast<int>(ProfilePhase::Count); i++) {
+			counters->calls[i] = 0;
+			counters->ns[i] = 0;
+			counters->allocations[i] = 0;
+		}
+		for (std::atomic<uint64_t>& op : counters->ops) op = 0;
+	}
+	for (const auto& [source, profile] : registry.expressions) {
+		profile->runs = 0;
+		profile->ns = 0;
+		for (std::atomic<uint64_t>& bucket : profile->buckets) bucket = 0;
+	}
+}
+#endif
+
+// Defining CPP_EVAL_PROFILE_ALLOCATIONS in exactly one translation unit
+// replaces the global operator new so phases also report allocation counts.
+#if CPP_EVAL_PROFILE && defined(CPP_EVAL_PROFILE_ALLOCATIONS)
+#include <cstdlib>
+#include <new>
+
+void* operator new(std::size_t size) {
+	profileAllocations++;
+	if (void* p = std::malloc(size ? size : 1)) return p;
+	throw std::bad_alloc();
+}
+
+// GCC cannot see that the replaced operator new above is malloc.
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* p) noexcept {
+	std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+	std::free(p);
+}
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+#endif
@@ -0,0 +1,355 @@
+#pragma once
+#include "eval.hpp"
+
+#include <tuple>
+
+// One node of the shared DAG. Children are node ids in ExprSet::children
+// [first, first + count) and always precede the node itself.
+struct SetNode {
+	TokenKind op;
+	Value value;
+	int operand = 0;
+	const NativeFunction* function = nullptr;
+	int first = 0;
+	int count = 0;
+};
+
+// Several expressions compiled into one DAG in which equal subexpressions,
+// across and within expressions, are a single node. A run evaluates each
+// node at most once, and only when an expression actually needs it, so
+// short-circuiting behaves as it does for a single CompiledExpr.
+struct ExprSet {
+	std::vector<SetNode> nodes;
+	std::vector<int> children;
+	std::vector<int> roots;
+	std::vector<std::wstring> variables;
+	// Nodes the expressions would need if compiled separately.
+	int unsharedNodes = 0;
+
+	int slotOf(std::wstring_view name) const {
+		for (int i = 0; i < variables.size(); i++) {
+			if (variables[i] == name) return i;
+		}
+		return -1;
+	}
+
+	// Writes one Value per expression into results; an empty expression
+	// yields an Unknown Value.
+	void execute(const Value* slots, Value* results, std::forward_list<std::wstring>& temps) const {
+		Frame frame{ slots, temps };
+		frame.memo.resize(nodes.size());
+		frame.ready.assign(nodes.size(), false);
+		for (int i = 0; i < roots.size(); i++) results[i] = roots[i] < 0 ? Value() : evaluate(roots[i], frame);
+	}
+
+	std::vector<Token> run(const std::vector<Value>& slots) const {
+		assert(slots.size() >= variables.size());
+		std::vector<Value> results(roots.size());
+		std::forward_list<std::wstring> temps;
+		execute(slots.data(), results.data(), temps);
+		std::vector<Token> tokens;
+		tokens.reserve(roots.size());
+		for (int i = 0; i < roots.size(); i++) tokens.push_back(roots[i] < 0 ? Token{ TokenKind::Unknown, L"" } : results[i].toToken());
+		return tokens;
+	}
+
+	std::vector<Token> run(const std::map<std::wstring, Value>& bindings) const {
+		std::vector<Value> slots(variables.size());
+		for (int i = 0; i < variables.size(); i++) {
+			auto it = bindings.find(variables[i]);
+			if (it != bindings.end()) slots[i] = it->second;
+		}
+		return run(slots);
+	}
+
+private:
+	friend class ReactiveSet;
+
+	struct Frame {
+		const Value* slots;
+		std::forward_list<std::wstring>& temps;
+		std::vector<Value> memo;
+		std::vector<bool> ready;
+		// Nodes evaluated by this frame, when set.
+		std::vector<int>* computed = nullptr;
+		// Nodes waiting for their operands. evaluate walks the DAG with this
+		// instead of recursing, so a chain of any length fits.
+		std::vector<int> pending;
+	};
+
+	// Literals and variables are read in place and never memoized.
+	static bool isLeaf(const SetNode& node) {
+		return node.count == 0 && node.op != TokenKind::Function;
+	}
+
+	bool available(int id, const Frame& frame) const {
+		return frame.ready[id] || isLeaf(nodes[id]);
+	}
+
+	const Value& valueOf(int id, const Frame& frame) const {
+		const SetNode& node = nodes[id];
+		if (!isLeaf(node)) return frame.memo[id];
+		return node.op == TokenKind::Variable ? frame.slots[node.operand] : node.value;
+	}
+
+	Value evaluate(int root, Frame& frame) const {
+		std::vector<int>& pending = frame.pending;
+		pending.push_back(root);
+		while (!pending.empty()) {
+			int id = pending.back();
+			const SetNode& node = nodes[id];
+			if (available(id, frame)) {
+				pending.pop_back();
+				continue;
+			}
+			const int* args = children.data() + node.first;
+			// The right side of and/or is needed only once the left side has
+			// not decided the result.
+			int needed = node.count;
+			if (node.op == TokenKind::And || node.op == TokenKind::Or) {
+				TokenKind proceed = node.op == TokenKind::And ? TokenKind::True : TokenKind::False;
+				needed = available(args[0], frame) && valueOf(args[0], frame).type == proceed ? 2 : 1;
+			}
+			size_t size = pending.size();
+			for (int k = needed - 1; k >= 0; k--) {
+				if (!available(args[k], frame)) pending.push_back(args[k]);
+			}
+			if (pending.size() != size) continue;
+			pending.pop_back();
+			frame.memo[id] = compute(node, args, frame);
+			frame.ready[id] = true;
+			if (frame.computed) frame.computed->push_back(id);
+		}
+		return valueOf(root, frame);
+	}
+
+	// Computes a node whose needed operands are all available. An Unknown
+	// operand, such as an unbound variable or an Int division by zero, makes
+	// the node Unknown too.
+	Value compute(const SetNode& node, const int* args, Frame& frame) const {
+		if (node.op == TokenKind::And || node.op == TokenKind::Or) {
+			const Value& x = valueOf(args[0], frame);
+			if (x.type == TokenKind::Unknown) return Value();
+			if (!isBool(x)) assert(false);
+			if ((x.type == TokenKind::True) != (node.op == TokenKind::And)) return x;
+			const Value& y = valueOf(args[1], frame);
+			if (y.type == TokenKind::Unknown) return Value();
+			if (!isBool(y)) assert(false);
+			return y;
+		}
+		for (int k = 0; k < node.count; k++) {
+			if (valueOf(args[k], frame).type == TokenKind::Unknown) return Value();
+		}
+		Value result;
+		switch (node.op) {
+		case TokenKind::Negative: {
+			const Value& x = valueOf(args[0], frame);
+			if (x.type == TokenKind::Int) result = Value::fromInt(negateInt(x.i));
+			else if (x.type == TokenKind::Float) result = Value::fromFloat(-x.f);
+			else assert(false);
+			break;
+		}
+		case TokenKind::Not: {
+			const Value& x = valueOf(args[0], frame);
+			if (!isBool(x)) assert(false);
+			result = Value::fromBool(x.type == TokenKind::False);
+			break;
+		}
+		case TokenKind::Function: {
+			Value local[8];
+			std::vector<Value> heap;
+			Value* values = local;
+			if (node.count > 8) {
+				heap.resize(node.count);
+				values = heap.data();
+			}
+			for (int k = 0; k < node.count; k++) values[k] = valueOf(args[k], frame);
+			result = node.function->call(node.function->target.get(), values, frame.temps);
+			break;
+		}
+		default: {
+			const Value& x = valueOf(args[0], frame);
+			const Value& y = valueOf(args[1], frame);
+			switch (node.op) {
+			case TokenKind::Add:
+				if (x.type == TokenKind::String && y.type == TokenKind::String) {
+					result = Value::fromString(&frame.temps.emplace_front(*x.s + *y.s));
+				}
+				else result = arithmetic(x, y, [](auto a, auto b) { return a + b; });
+				break;
+			case TokenKind::Sub: result = arithmetic(x, y, [](auto a, auto b) { return a - b; }); break;
+			case TokenKind::Mul: result = arithmetic(x, y, [](auto a, auto b) { return a * b; }); break;
+			case TokenKind::Div:
+				if (x.type == TokenKind::Int && y.type == TokenKind::Int) result = y.i == 0 ? Value() : Value::fromInt(divideInt(x.i, y.i));
+				else result = arithmetic(x, y, [](auto a, auto b) { return a / b; });
+				break;
+			case TokenKind::IsEqual: result = Value::fromBool(equals(x, y)); break;
+			case TokenKind::IsNotEqual: result = Value::fromBool(!equals(x, y)); break;
+			case TokenKind::IsLess: result = compare(x, y, [](auto a, auto b) { return a < b; }); break;
+			case TokenKind::IsLessEqual: result = compare(x, y, [](auto a, auto b) { return a <= b; }); break;
+			default: assert(false); break;
+			}
+			break;
+		}
+		}
+		return result;
+	}
+};
+
+// Compiles each source on its own (so constant folding still applies) and
+// merges the optimized programs by hash-consing. Operands of == and != are
+// ordered and > / >= become < / <= with swapped operands, so "a > 3" and
+// "3 < a" share a node.
+inline ExprSet compileSet(std::span<const std::wstring> sources) {
+	ExprSet set;
+	using Key = std::tuple<TokenKind, TokenKind, uint64_t, int, const NativeFunction*, std::vector<int>>;
+	std::map<Key, int> index;
+	std::vector<int> stack;
+	for (const std::wstring& src : sources) {
+		CompiledExpr expr = compile(src);
+		set.unsharedNodes += expr.program.size();
+		stack.clear();
+		for (const Instr& instr : expr.program) {
+			SetNode node{ instr.op, instr.value };
+			int count = operandCount(instr);
+			std::vector<int> operands(stack.end() - count, stack.end());
+			stack.resize(stack.size() - count);
+			if (instr.op == TokenKind::Variable) {
+				const std::wstring& name = expr.variables[instr.operand];
+				node.operand = set.slotOf(name);
+				if (node.operand < 0) {
+					node.operand = set.variables.size();
+					set.variables.push_back(name);
+				}
+			}
+			node.function = instr.function;
+			if (node.op == TokenKind::IsGreat || node.op == TokenKind::IsGreatEqual) {
+				node.op = node.op == TokenKind::IsGreat ? TokenKind::IsLess : TokenKind::IsLessEqual;
+				std::swap(operands[0], operands[1]);
+			}
+			if ((node.op == TokenKind::IsEqual || node.op == TokenKind::IsNotEqual) && operands[1] < operands[0]) {
+				std::swap(operands[0], operands[1]);
+			}
+			Key key{ node.op, node.value.type, valueBits(node.value), node.operand, node.function, operands };
+			auto inserted = index.emplace(std::move(key), set.nodes.size());
+			if (inserted.second) {
+				node.first = set.children.size();
+				node.count = operands.size();
+				set.children.insert(set.children.end(), operands.begin(), operands.end());
+				set.nodes.push_back(node);
+			}
+			stack.push_back(inserted.first->second);
+		}
+		set.roots.push_back(stack.empty() ? -1 : stack.back());
+	}
+	return set;
+}
+
+// Evaluates an ExprSet against one record whose fields change one at a time.
+// Node results are kept between reads; set() marks only the nodes that
+// depend on the changed variable stale, and reading a result recomputes just
+// the stale nodes it still needs. A single expression is a set of one.
+class ReactiveSet {
+public:
+	explicit ReactiveSet(ExprSet exprs)
+		: expressions(std::move(exprs)), slots(expressions.variables.size()), slotStrings(expressions.variables.size()),
+		frame{ slots.data(), temps }, strings(expressions.nodes.size()), variableNodes(expressions.variables.size(), -1) {
+		frame.memo.resize(expressions.nodes.size());
+		frame.ready.assign(expressions.nodes.size(), false);
+		frame.computed = &computed;
+		parentFirst.assign(expressions.nodes.size() + 1, 0);
+		for (const SetNode& node : expressions.nodes) {
+			for (int k = 0; k < node.count; k++) parentFirst[expressions.children[node.first + k] + 1]++;
+		}
+		for (int id = 0; id < expressions.nodes.size(); id++) parentFirst[id + 1] += parentFirst[id];
+		parents.resize(parentFirst.back());
+		std::vector<int> next(parentFirst.begin(), parentFirst.end() - 1);
+		for (int id = 0; id < expressions.nodes.size(); id++) {
+			const SetNode& node = expressions.nodes[id];
+			for (int k = 0; k < node.count; k++) parents[next[expressions.children[node.first + k]]++] = id;
+			if (node.op == TokenKind::Variable) variableNodes[node.operand] = id;
+		}
+	}
+
+	ReactiveSet(const ReactiveSet&) = delete;
+	ReactiveSet& operator=(const ReactiveSet&) = delete;
+
+	const ExprSet& compiled() const { return expressions; }
+
+	// Strings are copied unless interned, so v need not outlive the call.
+	void set(int slot, Value v) {
+		Value& current = slots[slot];
+		bool same = v.type == current.type && (v.type == TokenKind::String ? *v.s == *current.s : valueBits(v) == valueBits(current));
+		if (same) return;
+		if (v.type == TokenKind::String && !v.interned) v = Value::fromString(&(slotStrings[slot] = *v.s));
+		current = v;
+		if (variableNodes[slot] < 0) return;
+		pending.clear();
+		pushParents(variableNodes[slot]);
+		while (!pending.empty()) {
+			int id = pending.back();
+			pending.pop_back();
+			// A node that is already stale has no fresh parent that used it.
+			if (!frame.ready[id]) continue;
+			frame.ready[id] = false;
+			pushParents(id);
+		}
+	}
+
+	// Names no expression uses are ignored, as with ExprSet::run.
+	void set(std::wstring_view name, const Value& v) {
+		int slot = expressions.slotOf(name);
+		if (slot >= 0) set(slot, v);
+	}
+
+	// The result of expression i. A String result is valid until the next set().
+	Value value(int i) {
+		int root = expressions.roots[i];
+		if (root < 0) return Value();
+		if (frame.ready[root]) return frame.memo[root];
+		Value result = expressions.evaluate(root, frame);
+		keepStrings();
+		// Literal and variable roots are not memoized.
+		return frame.ready[root] ? frame.memo[root] : result;
+	}
+
+	std::vector<Token> run() {
+		std::vector<Token> tokens;
+		tokens.reserve(expressions.roots.size());
+		for (int i = 0; i < expressions.roots.size(); i++) tokens.push_back(value(i).toToken());
+		return tokens;
+	}
+
+	// Node evaluations since construction.
+	uint64_t recomputed = 0;
+
+private:
+	ExprSet expressions;
+	std::vector<Value> slots;
+	std::vector<std::wstring> slotStrings;
+	std::forward_list<std::wstring> temps;
+	ExprSet::Frame frame;
+	// Per-node copies of String results, so temps can be dropped after a read.
+	std::vector<std::wstring> strings;
+	std::vector<int> computed;
+	std::vector<int> parentFirst;
+	std::vector<int> parents;
+	std::vector<int> variableNodes;
+	std::vector<int> pending;
+
+	void pushParents(int id) {
+		for (int k = parentFirst[id]; k < parentFirst[id + 1]; k++) {
+			if (frame.ready[parents[k]]) pending.push_back(parents[k]);
+		}
+	}
+
+	void keepStrings() {
+		recomputed += computed.size();
+		for (int id : computed) {
+			Value& v = frame.memo[id];
+			if (v.type == TokenKind::String && !v.interned) v = Value::fromString(&(strings[id] = *v.s));
+		}
+		computed.clear();
+		temps.clear();
+	}
+};
@@ -0,0 +1,331 @@
+#pragma once
+#include "eval.hpp"
+
+#include <atomic>
+#include <cstddef>
+
+#if defined(__x86_64__) && defined(__unix__)
+#include <sys/mman.h>
+#define CPP_EVAL_JIT 1
+#else
+#define CPP_EVAL_JIT 0
+#endif
+
+// Native code for one expression; slots are read as Floats.
+using JitFunction = double (*)(const Value* slots);
+
+class JitCode {
+public:
+	JitCode(void* memory, size_t size, TokenKind result) : memory(memory), size(size), result(result) {}
+	JitCode(const JitCode&) = delete;
+	JitCode& operator=(const JitCode&) = delete;
+
+	~JitCode() {
+#if CPP_EVAL_JIT
+		munmap(memory, size);
+#endif
+	}
+
+	JitFunction entry() const { return reinterpret_cast<JitFunction>(memory); }
+
+	Value call(const Value* slots) const {
+		double v = entry()(slots);
+		return result == TokenKind::Float ? Value::fromFloat(v) : Value::fromBool(v != 0.0);
+	}
+
+private:
+	void* memory;
+	size_t size;
+	TokenKind result;
+};
+
+const int JitMaxArity = 8;
+
+inline bool jitCallable(const NativeFunction& fn) {
+	if (!fn.batch || fn.result != TokenKind::Float || fn.arity > JitMaxArity) return false;
+	return std::all_of(fn.parameters.begin(), fn.parameters.end(), [](TokenKind k) { return k == TokenKind::Float; });
+}
+
+// Called from generated code: arguments sit in consecutive temporaries and the
+// result replaces the first of them.
+inline void jitCall(const NativeFunction* fn, double* args) {
+	const double* pointers[JitMaxArity];
+	for (int k = 0; k < fn->arity; k++) pointers[k] = args + k;
+	fn->batch(fn->target.get(), pointers, args, 1);
+}
+
+struct X64Assembler {
+	std::vector<uint8_t> bytes;
+
+	void byte(std::initializer_list<uint8_t> list) { bytes.insert(bytes.end(), list); }
+
+	void imm32(uint32_t v) {
+		for (int i = 0; i < 4; i++) bytes.push_back(v >> (8 * i));
+	}
+
+	void imm64(uint64_t v) {
+		for (int i = 0; i < 8; i++) bytes.push_back(v >> (8 * i));
+	}
+
+	// movsd xmm, [base + disp] (store = false) or movsd [base + disp], xmm.
+	// base is 3 (rbx) or 4 (rsp).
+	void movsd(int xmm, int base, int32_t disp, bool store) {
+		byte({ 0xF2, 0x0F, static_cast<uint8_t>(store ? 0x11 : 0x10), static_cast<uint8_t>(0x80 | xmm << 3 | base) });
+		if (base == 4) bytes.push_back(0x24);
+		imm32(disp);
+	}
+
+	void movabsRax(uint64_t v) { byte({ 0x48, 0xB8 }); imm64(v); }
+	void movqXmmRax(int xmm) { byte({ 0x66, 0x48, 0x0F, 0x6E, static_cast<uint8_t>(0xC0 | xmm << 3) }); }
+
+	// Scalar or packed double op xmm0, xmm1.
+	void sse(uint8_t prefix, uint8_t op) { byte({ prefix, 0x0F, op, 0xC1 }); }
+
+	void loadConstant(int xmm, double v) {
+		uint64_t bits;
+		std::memcpy(&bits, &v, sizeof(bits));
+		movabsRax(bits);
+		movqXmmRax(xmm);
+	}
+};
+
+inline std::unique_ptr<JitCode> jitCompile(const CompiledExpr& expr) {
+#if CPP_EVAL_JIT
+	if (expr.code.empty()) return nullptr;
+	// Int here means an Int constant, which the interpreter only promotes when
+	// the other operand is a Float; all-Int arithmetic stays in the interpreter.
+	std::vector<TokenKind> types(expr.temporaries, TokenKind::Unknown);
+	auto typeOf = [&](uint16_t reg) {
+		int index = reg & RegisterSpace::RegisterIndex;
+		switch (reg & ~RegisterSpace::RegisterIndex) {
+		case RegisterSpace::Slot: {
+			// Slots are read as Floats; other declared types stay in the interpreter.
+			TokenKind type = expr.types.empty() ? TokenKind::Unknown : expr.types[index];
+			return type == TokenKind::Unknown || type == TokenKind::Float ? TokenKind::Float : TokenKind::Unknown;
+		}
+		case RegisterSpace::Constant: {
+			TokenKind type = expr.constants[index].type;
+			return type == TokenKind::False ? TokenKind::True : type;
+		}
+		default: return types[index];
+		}
+	};
+	auto number = [](TokenKind t) { return t == TokenKind::Int || t == TokenKind::Float; };
+	auto mixed = [&](const Bytecode& in) {
+		TokenKind x = typeOf(in.b), y = typeOf(in.c);
+		return number(x) && number(y) && (x == TokenKind::Float || y == TokenKind::Float);
+	};
+	TokenKind result = TokenKind::Unknown;
+	// Specialized opcodes are compiled as their generic forms, whose operand
+	// types are checked here anyway.
+	for (const Bytecode& in : expr.code) {
+		TokenKind type = TokenKind::Unknown;
+		switch (genericOpcode(in.op)) {
+		case OpCode::Move: type = typeOf(in.b); break;
+		case OpCode::Negative: if (typeOf(in.b) == TokenKind::Float) type = TokenKind::Float; break;
+		case OpCode::Not: if (typeOf(in.b) == TokenKind::True) type = TokenKind::True; break;
+		case OpCode::Add: case OpCode::Sub: case OpCode::Mul: case OpCode::Div:
+			if (mixed(in)) type = TokenKind::Float;
+			break;
+		case OpCode::IsEqual: case OpCode::IsNotEqual:
+			if (typeOf(in.b) == TokenKind::True && typeOf(in.c) == TokenKind::True) type = TokenKind::True;
+			[[fallthrough]];
+		case OpCode::IsGreat: case OpCode::IsLess: case OpCode::IsGreatEqual: case OpCode::IsLessEqual:
+			if (mixed(in)) type = TokenKind::True;
+			break;
+		case OpCode::And: case OpCode::Or:
+			if (typeOf(in.b) == TokenKind::True && typeOf(in.c) == TokenKind::True) type = TokenKind::True;
+			break;
+		case OpCode::Call: {
+			const NativeFunction& fn = *expr.functions[in.c];
+			bool numeric = true;
+			for (int k = 0; k < fn.arity; k++) numeric = numeric && number(types[in.a + k]);
+			if (jitCallable(fn) && numeric) type = TokenKind::Float;
+			break;
+		}
+		case OpCode::JumpIfTrue: case OpCode::JumpIfFalse:
+			if (typeOf(in.a) != TokenKind::True) return nullptr;
+			continue;
+		case OpCode::Return:
+			result = typeOf(in.a);
+			if (result != TokenKind::Float && result != TokenKind::True) return nullptr;
+			continue;
+		default:
+			break;
+		}
+		if (type == TokenKind::Unknown) return nullptr;
+		types[in.a] = type;
+	}
+
+	X64Assembler as;
+	int frame = (expr.temporaries * 8 + 15) & ~15;
+	auto load = [&](int xmm, uint16_t reg) {
+		int index = reg & RegisterSpace::RegisterIndex;
+		switch (reg & ~RegisterSpace::RegisterIndex) {
+		case RegisterSpace::Slot: as.movsd(xmm, 3, index * sizeof(Value) + offsetof(Value, f), false); break;
+		case RegisterSpace::Constant: {
+			const Value& v = expr.constants[index];
+			as.loadConstant(xmm, v.type == TokenKind::Float ? v.f : v.type == TokenKind::Int ? v.i : v.type == TokenKind::True);
+			break;
+		}
+		default: as.movsd(xmm, 4, index * 8, false); break;
+		}
+	};
+	auto store = [&](uint16_t reg) { as.movsd(0, 4, reg * 8, true); };
+	as.byte({ 0x53, 0x48, 0x89, 0xFB });
+	as.byte({ 0x48, 0x81, 0xEC });
+	as.imm32(frame);
+	std::vector<size_t> offsets(expr.code.size() + 1);
+	std::vector<std::pair<size_t, int>> fixups;
+	for (int i = 0; i < expr.code.size(); i++) {
+		const Bytecode& in = expr.code[i];
+		OpCode op = genericOpcode(in.op);
+		offsets[i] = as.bytes.size();
+		switch (op) {
+		case OpCode::Move: load(0, in.b); store(in.a); break;
+		case OpCode::Negative:
+			load(0, in.b);
+			as.movabsRax(0x8000000000000000ull);
+			as.movqXmmRax(1);
+			as.sse(0x66, 0x57);
+			store(in.a);
+			break;
+		case OpCode::Not:
+			load(1, in.b);
+			as.loadConstant(0, 1.0);
+			as.sse(0xF2, 0x5C);
+			store(in.a);
+			break;
+		case OpCode::Add: case OpCode::Sub: case OpCode::Mul: case OpCode::Div: case OpCode::And: case OpCode::Or: {
+			static const uint8_t codes[][2] = {
+				{ 0xF2, 0x58 }, { 0xF2, 0x5C }, { 0xF2, 0x59 }, { 0xF2, 0x5E }, { 0x66, 0x54 }, { 0x66, 0x56 },
+			};
+			int k = op <= OpCode::Div ? static_cast<int>(op) - static_cast<int>(OpCode::Add) : 4 + (op == OpCode::Or);
+			load(0, in.b);
+			load(1, in.c);
+			as.sse(codes[k][0], codes[k][1]);
+			store(in.a);
+			break;
+		}
+		case OpCode::IsEqual: case OpCode::IsNotEqual: case OpCode::IsGreat: case OpCode::IsLess: case OpCode::IsGreatEqual: case OpCode::IsLessEqual: {
+			// cmpsd predicates: 0 eq, 1 lt, 2 le, 4 neq; > and >= swap operands.
+			bool swap = op == OpCode::IsGreat || op == OpCode::IsGreatEqual;
+			uint8_t predicate = op == OpCode::IsEqual ? 0 : op == OpCode::IsNotEqual ? 4
+				: op == OpCode::IsGreat || op == OpCode::IsLess ? 1 : 2;
+			load(0, swap ? in.c : in.b);
+			load(1, swap ? in.b : in.c);
+			as.byte({ 0xF2, 0x0F, 0xC2, 0xC1, predicate });
+			as.loadConstant(1, 1.0);
+			as.sse(0x66, 0x54);
+			store(in.a);
+			break;
+		}
+		case OpCode::Call:
+			as.byte({ 0x48, 0xBF });
+			as.imm64(reinterpret_cast<uint64_t>(expr.functions[in.c]));
+			as.byte({ 0x48, 0x8D, 0xB4, 0x24 });
+			as.imm32(in.a * 8);
+			as.movabsRax(reinterpret_cast<uint64_t>(&jitCall));
+			as.byte({ 0xFF, 0xD0 });
+			break;
+		case OpCode::JumpIfTrue: case OpCode::JumpIfFalse:
+			load(0, in.a);
+			as.byte({ 0x66, 0x0F, 0x57, 0xC9 });
+			as.byte({ 0x66, 0x0F, 0x2E, 0xC1 });
+			as.byte({ 0x0F, static_cast<uint8_t>(op == OpCode::JumpIfTrue ? 0x85 : 0x84) });
+			fixups.push_back({ as.bytes.size(), i + 1 + static_cast<int>(in.offset()) });
+			as.imm32(0);
+			break;
+		case OpCode::Return:
+			load(0, in.a);
+			as.byte({ 0x48, 0x81, 0xC4 });
+			as.imm32(frame);
+			as.byte({ 0x5B, 0xC3 });
+			break;
+		default:
+			break;
+		}
+	}
+	offsets[expr.code.size()] = as.bytes.size();
+	for (auto [at, target] : fixups) {
+		int32_t rel = offsets[target] - (at + 4);
+		std::memcpy(&as.bytes[at], &rel, sizeof(rel));
+	}
+
+	size_t size = as.bytes.size();
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) return nullptr;
+	std::memcpy(memory, as.bytes.data(), size);
+	if (mprotect(memory, size, PROT_READ | PROT_EXEC) != 0) {
+		munmap(memory, size);
+		return nullptr;
+	}
+	return std::make_unique<JitCode>(memory, size, result);
+#else
+	return nullptr;
+#endif
+}
+
+// Interprets an expression until it has run threshold times, then compiles
+// it to native code if it stays within the numeric subset. Calls whose
+// variables are not all Floats keep using the interpreter.
+class HotExpr {
+public:
+	explicit HotExpr(CompiledExpr expr, uint32_t threshold = 1000) : expr(std::move(expr)), threshold(threshold) {
+		const std::vector<TokenKind>& types = this->expr.types;
+		floatSlots = !types.empty() && std::all_of(types.begin(), types.end(), [](TokenKind t) { return t == TokenKind::Float; });
+		if (threshold == 0) promote();
+	}
+
+	const CompiledExpr& compiled() const { return expr; }
+	bool promoted() const { return jit.load(std::memory_order_acquire) != nullptr; }
+
+	Value execute(const Value* slots, std::forward_list<std::wstring>& temps) const {
+		if (const JitCode* code = jit.load(std::memory_order_acquire)) {
+			// Slots declared Float are the caller's to guarantee.
+			bool floats = true;
+			for (int i = 0; !floatSlots && i < expr.variables.size(); i++) floats = floats && slots[i].type == TokenKind::Float;
+			if (floats) return code->call(slots);
+		}
+		else if (cold.load(std::memory_order_relaxed) && evaluations.fetch_add(1, std::memory_order_relaxed) + 1 == threshold) {
+			promote();
+		}
+		return expr.execute(slots, temps);
+	}
+
+	Token run() const {
+		std::vector<Value> slots(expr.variables.size());
+		return run(slots);
+	}
+
+	Token run(const std::vector<Value>& slots) const {
+		if (expr.program.empty()) return { TokenKind::Unknown, L"" };
+		assert(slots.size() >= expr.variables.size());
+		std::forward_list<std::wstring> temps;
+		return execute(slots.data(), temps).toToken();
+	}
+
+	Token run(const std::map<std::wstring, Value>& bindings) const {
+		std::vector<Value> slots(expr.variables.size());
+		for (int i = 0; i < expr.variables.size(); i++) {
+			auto it = bindings.find(expr.variables[i]);
+			if (it != bindings.end()) slots[i] = it->second;
+		}
+		return run(slots);
+	}
+
+private:
+	CompiledExpr expr;
+	uint32_t threshold;
+	bool floatSlots;
+	mutable std::atomic<uint32_t> evaluations{0};
+	mutable std::atomic<bool> cold{true};
+	mutable std::atomic<const JitCode*> jit{nullptr};
+	mutable std::unique_ptr<JitCode> code;
+
+	void promote() const {
+		code = jitCompile(expr);
+		cold.store(false, std::memory_order_relaxed);
+		jit.store(code.get(), std::memory_order_release);
+	}
+};
@@ -0,0 +1,149 @@
+#pragma once
+#include "eval.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+
+class WorkStealingPool {
+public:
+	explicit WorkStealingPool(int threads = std::max(1u, std::thread::hardware_concurrency())) : queues(threads) {
+		for (int i = 1; i < threads; i++) {
+			workers.emplace_back([this, i] { workerLoop(i); });
+		}
+	}
+
+	~WorkStealingPool() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		for (std::thread& worker : workers) worker.join();
+	}
+
+	int size() const { return queues.size(); }
+
+	// Splits [0, count) into ranges of at most grain items and runs body on
+	// them across all threads; idle threads steal ranges from busy ones.
+	// The calling thread takes part and returns once every range is done.
+	void parallelFor(size_t count, size_t grain, const std::function<void(size_t, size_t)>& body) {
+		if (count == 0) return;
+		std::lock_guard<std::mutex> submitLock(submit);
+		grain = std::max<size_t>(grain, 1);
+		size_t ranges = (count + grain - 1) / grain;
+		for (size_t r = 0; r < ranges; r++) {
+			Queue& queue = queues[r % queues.size()];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.ranges.push_back({ r * grain, std::min(count, (r + 1) * grain) });
+		}
+		remaining.store(ranges);
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			task = &body;
+			generation++;
+		}
+		wake.notify_all();
+		runRanges(0, body);
+		std::unique_lock<std::mutex> lock(mutex);
+		done.wait(lock, [this] { return remaining.load() == 0 && busy == 0; });
+		task = nullptr;
+	}
+
+	static WorkStealingPool& shared() {
+		static WorkStealingPool pool;
+		return pool;
+	}
+
+private:
+	struct Queue {
+		std::mutex mutex;
+		std::deque<std::pair<size_t, size_t>> ranges;
+	};
+
+	std::vector<Queue> queues;
+	std::vector<std::thread> workers;
+	std::mutex submit;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	const std::function<void(size_t, size_t)>* task = nullptr;
+	std::atomic<size_t> remaining{0};
+	int busy = 0;
+	size_t generation = 0;
+	bool stopping = false;
+
+	bool take(int self, std::pair<size_t, size_t>& range) {
+		{
+			Queue& own = queues[self];
+			std::lock_guard<std::mutex> lock(own.mutex);
+			if (!own.ranges.empty()) {
+				range = own.ranges.back();
+				own.ranges.pop_back();
+				return true;
+			}
+		}
+		for (int i = 1; i < queues.size(); i++) {
+			Queue& victim = queues[(self + i) % queues.size()];
+			std::lock_guard<std::mutex> lock(victim.mutex);
+			if (!victim.ranges.empty()) {
+				range = victim.ranges.front();
+				victim.ranges.pop_front();
+				return true;
+			}
+		}
+		return false;
+	}
+
+	void runRanges(int self, const std::function<void(size_t, size_t)>& body) {
+		std::pair<size_t, size_t> range;
+		while (take(self, range)) {
+			body(range.first, range.second);
+			if (remaining.fetch_sub(1) == 1) {
+				std::lock_guard<std::mutex> lock(mutex);
+				done.notify_all();
+			}
+		}
+	}
+
+	void workerLoop(int self) {
+		size_t seen = 0;
+		while (true) {
+			const std::function<void(size_t, size_t)>* body;
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				wake.wait(lock, [&] { return stopping || (task != nullptr && generation != seen); });
+				if (stopping) return;
+				seen = generation;
+				body = task;
+				busy++;
+			}
+			runRanges(self, *body);
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				busy--;
+			}
+			done.notify_all();
+		}
+	}
+};
+
+struct EvalJob {
+	std::wstring source;
+	std::map<std::wstring, Value> bindings;
+	const CompiledExpr* compiled = nullptr;
+};
+
+// Evaluates every job on the pool and returns the results in job order.
+// A job runs its precompiled expression if set, otherwise compiles source.
+inline std::vector<Token> evalParallel(const std::vector<EvalJob>& jobs, WorkStealingPool& pool = WorkStealingPool::shared()) {
+	std::vector<Token> results(jobs.size());
+	pool.parallelFor(jobs.size(), 32, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			const EvalJob& job = jobs[i];
+			results[i] = job.compiled ? job.compiled->run(job.bindings) : compile(job.source).run(job.bindings);
+		}
+	});
+	return results;
+}
@@ -0,0 +1,526 @@
+#pragma once
+#include "eval.hpp"
+
+#include <limits>
+#include <optional>
+#include <tuple>
+
+// An expression literal usable as a template argument; narrow literals are
+// widened character by character, so they must be ASCII.
+template <size_t N>
+struct FixedString {
+	wchar_t data[N] = {};
+
+	constexpr FixedString(const char (&src)[N]) {
+		for (size_t i = 0; i < N; i++) data[i] = src[i];
+	}
+
+	constexpr FixedString(const wchar_t (&src)[N]) {
+		for (size_t i = 0; i < N; i++) data[i] = src[i];
+	}
+
+	static constexpr size_t size() { return N - 1; }
+	constexpr std::wstring_view view() const { return { data, N - 1 }; }
+};
+
+enum class StaticFunction { Sin, Cos, Tan, Pow, Sqrt, Log, Exp, Abs, Min, Max, None };
+
+struct StaticBuiltin {
+	std::wstring_view name;
+	int arity;
+};
+
+// The compile-time front end only knows the built-in functions; functions
+// registered at run time need compile(std::wstring_view).
+constexpr StaticBuiltin staticBuiltins[] = {
+	{ L"sin", 1 }, { L"cos", 1 }, { L"tan", 1 }, { L"pow", 2 }, { L"sqrt", 1 },
+	{ L"log", 1 }, { L"exp", 1 }, { L"abs", 1 }, { L"min", 2 }, { L"max", 2 },
+};
+
+constexpr StaticFunction staticFunction(std::wstring_view name) {
+	for (int i = 0; i < std::size(staticBuiltins); i++) {
+		if (staticBuiltins[i].name == name) return static_cast<StaticFunction>(i);
+	}
+	return StaticFunction::None;
+}
+
+// Not constexpr on purpose: reaching it during constant evaluation turns the
+// message into a compile error.
+inline void staticParseError(const char* message) {}
+
+// An unsigned integer of any size as little-endian 32-bit words with no
+// leading zero word, for parsing Float literals exactly.
+struct StaticBigInt {
+	std::vector<uint32_t> words;
+
+	constexpr void multiplyAdd(uint32_t factor, uint32_t add) {
+		uint64_t carry = add;
+		for (uint32_t& word : words) {
+			carry += static_cast<uint64_t>(word) * factor;
+			word = static_cast<uint32_t>(carry);
+			carry >>= 32;
+		}
+		if (carry) words.push_back(static_cast<uint32_t>(carry));
+	}
+
+	constexpr void shiftLeft(int bits) {
+		if (words.empty()) return;
+		words.insert(words.begin(), bits / 32, 0);
+		bits %= 32;
+		if (bits == 0) return;
+		uint32_t carry = 0;
+		for (uint32_t& word : words) {
+			uint32_t next = word >> (32 - bits);
+			word = word << bits | carry;
+			carry = next;
+		}
+		if (carry) words.push_back(carry);
+	}
+
+	constexpr void shiftRightOne() {
+		for (size_t k = 0; k < words.size(); k++) {
+			words[k] = words[k] >> 1 | (k + 1 < words.size() ? words[k + 1] << 31 : 0);
+		}
+		if (!words.empty() && words.back() == 0) words.pop_back();
+	}
+
+	constexpr int bitLength() const {
+		int bits = words.empty() ? 0 : (words.size() - 1) * 32;
+		for (uint32_t top = words.empty() ? 0 : words.back(); top; top >>= 1) bits++;
+		return bits;
+	}
+
+	constexpr bool operator>=(const StaticBigInt& other) const {
+		if (words.size() != other.words.size()) return words.size() > other.words.size();
+		for (size_t k = words.size(); k-- > 0;) {
+			if (words[k] != other.words[k]) return words[k] > other.words[k];
+		}
+		return true;
+	}
+
+	// Requires *this >= other.
+	constexpr void subtract(const StaticBigInt& other) {
+		int64_t borrow = 0;
+		for (size_t k = 0; k < words.size(); k++) {
+			int64_t difference = static_cast<int64_t>(words[k]) - (k < other.words.size() ? other.words[k] : 0) - borrow;
+			borrow = difference < 0;
+			words[k] = static_cast<uint32_t>(difference + (borrow << 32));
+		}
+		while (!words.empty() && words.back() == 0) words.pop_back();
+	}
+};
+
+// Rounds the literal's exact value to the nearest double, ties to even, so
+// that it matches the wcstod used by compile().
+constexpr double parseStaticFloat(std::wstring_view text) {
+	StaticBigInt numerator, denominator;
+	denominator.words.push_back(1);
+	bool point = false;
+	for (wchar_t c : text) {
+		if (c == L'.') {
+			if (point) staticParseError("malformed Float literal");
+			point = true;
+			continue;
+		}
+		numerator.multiplyAdd(10, c - L'0');
+		if (point) denominator.multiplyAdd(10, 0);
+	}
+	if (numerator.words.empty()) return 0;
+	// quotient = floor(value * 2^scale), brought into [2^53, 2^54).
+	int scale = 54 - (numerator.bitLength() - denominator.bitLength());
+	if (scale >= 0) numerator.shiftLeft(scale);
+	else denominator.shiftLeft(-scale);
+	denominator.shiftLeft(55);
+	uint64_t quotient = 0;
+	for (int bit = 55; bit >= 0; bit--) {
+		if (numerator >= denominator) {
+			numerator.subtract(denominator);
+			quotient |= uint64_t(1) << bit;
+		}
+		denominator.shiftRightOne();
+	}
+	bool sticky = !numerator.words.empty();
+	if (quotient >= uint64_t(1) << 54) {
+		sticky = sticky || (quotient & 1);
+		quotient >>= 1;
+		scale--;
+	}
+	// Drop one bit for a 53-bit mantissa, more below the normal range.
+	int dropped = std::max(1, scale - 1074);
+	if (dropped > 54) return 0;
+	uint64_t mantissa = quotient >> dropped;
+	bool half = (quotient >> (dropped - 1)) & 1;
+	sticky = sticky || (quotient & ((uint64_t(1) << (dropped - 1)) - 1));
+	if (half && (sticky || (mantissa & 1))) mantissa++;
+	int exponent = dropped - scale;
+	if ((mantissa >> 53 ? 53 : 52) + exponent >= 1024) return std::numeric_limits<double>::infinity();
+	double result = static_cast<double>(mantissa);
+	for (; exponent > 0; exponent--) result *= 2;
+	for (; exponent < 0; exponent++) result /= 2;
+	return result;
+}
+
+struct StaticNode {
+	TokenKind op = TokenKind::Unknown;
+	int lhs = -1;
+	int rhs = -1;
+	int64_t i = 0;
+	double f = 0;
+	int offset = 0;
+	int length = 0;
+};
+
+template <size_t N>
+struct StaticTree {
+	StaticNode nodes[N];
+	int count = 0;
+	int root = -1;
+	TokenView variables[N];
+	int variableCount = 0;
+};
+
+template <size_t N>
+consteval int tokenizeStatic(std::wstring_view src, TokenView (&result)[N]) {
+	int count = 0;
+	int index = 0;
+	int size = src.size();
+	while (index < size) {
+		int start = index;
+		switch (getCharType(src[index])) {
+		case CharType::WhiteSpace:
+			index++;
+			break;
+		case CharType::NumberLiteral: {
+			bool isFloat = false;
+			while (index < size && (getCharType(src[index]) == CharType::NumberLiteral || src[index] == L'.')) {
+				if (src[index] == L'.') isFloat = true;
+				index++;
+			}
+			result[count++] = { isFloat ? TokenKind::Float : TokenKind::Int, start, index - start };
+			break;
+		}
+		case CharType::StringLiteral:
+			index++;
+			while (index < size && src[index] != L'\"') index++;
+			if (index == size) staticParseError("unterminated String literal");
+			result[count++] = { TokenKind::String, start + 1, index - start - 1 };
+			index++;
+			break;
+		case CharType::IdentifierAndKeyword: {
+			while (index < size && (getCharType(src[index]) == CharType::IdentifierAndKeyword
+					|| getCharType(src[index]) == CharType::NumberLiteral || src[index] == L'_')) {
+				index++;
+			}
+			std::wstring_view word = src.substr(start, index - start);
+			TokenKind kind = keywordKind(word);
+			if (kind == TokenKind::Variable && staticFunction(word) != StaticFunction::None && startsArgument(src, index)) kind = TokenKind::Function;
+			result[count++] = { kind, start, index - start };
+			break;
+		}
+		case CharType::OperatorAndPunctuator: {
+			wchar_t next = index + 1 < size ? src[index + 1] : L'\0';
+			TokenKind kind = TokenKind::Unknown;
+			int length = 1;
+			switch (src[index]) {
+			case L'+': kind = TokenKind::Add; break;
+			case L'-': {
+				TokenKind last = count == 0 ? TokenKind::Unknown : result[count - 1].type;
+				bool binary = last == TokenKind::Int || last == TokenKind::Float || last == TokenKind::Variable || last == TokenKind::RightParent;
+				kind = binary ? TokenKind::Sub : TokenKind::Negative;
+				break;
+			}
+			case L'*': kind = TokenKind::Mul; break;
+			case L'/': kind = TokenKind::Div; break;
+			case L'(': kind = TokenKind::LeftParent; break;
+			case L')': kind = TokenKind::RightParent; break;
+			case L',': kind = TokenKind::Comma; break;
+			case L'=': if (next == L'=') { kind = TokenKind::IsEqual; length = 2; } break;
+			case L'!': if (next == L'=') { kind = TokenKind::IsNotEqual; length = 2; } break;
+			case L'>':
+				kind = next == L'=' ? TokenKind::IsGreatEqual : TokenKind::IsGreat;
+				length = next == L'=' ? 2 : 1;
+				break;
+			case L'<':
+				kind = next == L'=' ? TokenKind::IsLessEqual : TokenKind::IsLess;
+				length = next == L'=' ? 2 : 1;
+				break;
+			}
+			if (kind == TokenKind::Unknown) staticParseError("unexpected character");
+			result[count++] = { kind, start, length };
+			index += length;
+			break;
+		}
+		default:
+			staticParseError("unexpected character");
+			index++;
+			break;
+		}
+	}
+	return count;
+}
+
+// Same shunting-yard loop as compile(), building a tree instead of postfix.
+template <size_t N>
+consteval StaticTree<N> parseStatic(std::wstring_view src) {
+	StaticTree<N> tree;
+	TokenView tokens[N] = {};
+	int count = tokenizeStatic(src, tokens);
+	if (count == 0) staticParseError("empty expression");
+	int output[N] = {};
+	int depth = 0;
+	TokenView stack[N] = {};
+	int top = 0;
+	bool callParents[N] = {};
+	int parents = 0;
+	int arities[N] = {};
+	int calls = 0;
+	auto emit = [&](const TokenView& token, int argc) {
+		StaticNode node{ token.type };
+		std::wstring_view text = token.text(src);
+		switch (token.type) {
+		case TokenKind::Int:
+			if (!fitsInt(text)) staticParseError("integer literal out of range");
+			node.i = parseInt(text);
+			break;
+		case TokenKind::Float: node.f = parseStaticFloat(text); break;
+		case TokenKind::True: case TokenKind::False: break;
+		case TokenKind::String: node.offset = token.offset; node.length = token.length; break;
+		case TokenKind::Variable: {
+			node.i = tree.variableCount;
+			for (int k = 0; k < tree.variableCount; k++) {
+				if (tree.variables[k].text(src) == text) node.i = k;
+			}
+			if (node.i == tree.variableCount) tree.variables[tree.variableCount++] = token;
+			break;
+		}
+		case TokenKind::Function: {
+			node.i = static_cast<int>(staticFunction(text));
+			if (argc != staticBuiltins[node.i].arity) staticParseError("wrong number of function arguments");
+			if (depth < argc) staticParseError("missing function argument");
+			if (argc == 2) node.rhs = output[--depth];
+			if (argc >= 1) node.lhs = output[--depth];
+			break;
+		}
+		case TokenKind::Negative: case TokenKind::Not:
+			if (depth < 1) staticParseError("missing operand");
+			node.lhs = output[--depth];
+			break;
+		case TokenKind::LeftParent:
+			staticParseError("unbalanced parentheses");
+			break;
+		default:
+			if (depth < 2) staticParseError("missing operand");
+			node.rhs = output[--depth];
+			node.lhs = output[--depth];
+			break;
+		}
+		tree.nodes[tree.count] = node;
+		output[depth++] = tree.count++;
+	};
+	for (int n = 0; n < count; n++) {
+		TokenKind type = tokens[n].type;
+		if (type == TokenKind::Int || type == TokenKind::Float || type == TokenKind::String || type == TokenKind::True || type == TokenKind::False
+			|| type == TokenKind::Variable
+		) {
+			if (type == TokenKind::Variable && n + 1 < count && tokens[n + 1].type == TokenKind::LeftParent) staticParseError("unknown function");
+			emit(tokens[n], 0);
+		}
+		else if (type == TokenKind::LeftParent) {
+			bool call = n > 0 && tokens[n - 1].type == TokenKind::Function;
+			callParents[parents++] = call;
+			if (call) arities[calls++] = n + 1 < count && tokens[n + 1].type == TokenKind::RightParent ? 0 : 1;
+			stack[top++] = tokens[n];
+		}
+		else if (type == TokenKind::Comma) {
+			while (top > 0 && stack[top - 1].type != TokenKind::LeftParent) emit(stack[--top], 1);
+			if (parents == 0 || !callParents[parents - 1]) staticParseError("comma outside a function call");
+			arities[calls - 1]++;
+		}
+		else if (type == TokenKind::RightParent) {
+			while (top > 0 && stack[top - 1].type != TokenKind::LeftParent) emit(stack[--top], 1);
+			if (top == 0) staticParseError("unbalanced parentheses");
+			top--;
+			if (callParents[--parents]) {
+				emit(stack[--top], arities[--calls]);
+			}
+		}
+		else {
+			while (!isPrefixOperator(type) && top > 0 && evalPriority(type) <= evalPriority(stack[top - 1].type)) emit(stack[--top], 1);
+			stack[top++] = tokens[n];
+		}
+	}
+	while (top > 0) emit(stack[--top], 1);
+	if (depth != 1) staticParseError("expected an operator between operands");
+	tree.root = output[0];
+	return tree;
+}
+
+template <typename T>
+constexpr bool isStaticInt = std::is_same_v<T, int64_t>;
+
+template <typename T>
+constexpr bool isStaticNumber = std::is_same_v<T, int64_t> || std::is_same_v<T, double>;
+
+template <typename T>
+constexpr bool isStaticString = std::is_same_v<T, std::wstring_view> || std::is_same_v<T, std::wstring>;
+
+template <typename... T>
+constexpr bool staticTypeError = false;
+
+// Arguments keep the interpreter's types: integers are Int, floating point
+// values are Float, bools are True/False and anything viewable as wide text
+// is a String.
+template <typename T>
+constexpr auto staticValue(const T& v) {
+	if constexpr (std::is_same_v<T, bool>) return v;
+	else if constexpr (std::is_integral_v<T>) return static_cast<int64_t>(v);
+	else if constexpr (std::is_floating_point_v<T>) return static_cast<double>(v);
+	else if constexpr (std::is_convertible_v<const T&, std::wstring_view>) return std::wstring_view(v);
+	else static_assert(staticTypeError<T>, "unsupported argument type");
+}
+
+// Int results wrap like the interpreter's; division goes through divideInt.
+template <typename A, typename B, typename Op>
+constexpr auto staticArithmetic(const A& a, const B& b, Op op) {
+	if constexpr (isStaticInt<A> && isStaticInt<B>) return static_cast<int64_t>(op(static_cast<uint64_t>(a), static_cast<uint64_t>(b)));
+	else if constexpr (isStaticNumber<A> && isStaticNumber<B>) return op(static_cast<double>(a), static_cast<double>(b));
+	else static_assert(staticTypeError<A, B>, "arithmetic needs Int or Float operands");
+}
+
+template <typename A, typename B, typename Op>
+constexpr bool staticCompare(const A& a, const B& b, Op op) {
+	if constexpr (isStaticInt<A> && isStaticInt<B>) return op(a, b);
+	else if constexpr (isStaticNumber<A> && isStaticNumber<B>) return op(static_cast<double>(a), static_cast<double>(b));
+	else static_assert(staticTypeError<A, B>, "comparison needs Int or Float operands");
+}
+
+template <typename A, typename B>
+constexpr bool staticEquals(const A& a, const B& b) {
+	if constexpr (isStaticNumber<A> && isStaticNumber<B>) return staticCompare(a, b, [](auto x, auto y) { return x == y; });
+	else if constexpr (isStaticString<A> && isStaticString<B>) return std::wstring_view(a) == std::wstring_view(b);
+	else if constexpr (std::is_same_v<A, bool> && std::is_same_v<B, bool>) return a == b;
+	else static_assert(staticTypeError<A, B>, "== and != need operands of the same kind");
+}
+
+template <typename T>
+constexpr bool staticBool(const T& v) {
+	static_assert(std::is_same_v<T, bool>, "and, or and not need True/False operands");
+	return v;
+}
+
+template <typename T>
+constexpr double staticDouble(const T& v) {
+	static_assert(isStaticNumber<T>, "function arguments must be Int or Float");
+	return static_cast<double>(v);
+}
+
+template <StaticFunction F, typename X>
+constexpr auto staticCall(const X& x) {
+	if constexpr (F == StaticFunction::Sin) return std::sin(staticDouble(x));
+	else if constexpr (F == StaticFunction::Cos) return std::cos(staticDouble(x));
+	else if constexpr (F == StaticFunction::Tan) return std::tan(staticDouble(x));
+	else if constexpr (F == StaticFunction::Sqrt) return std::sqrt(staticDouble(x));
+	else if constexpr (F == StaticFunction::Log) return std::log(staticDouble(x));
+	else if constexpr (F == StaticFunction::Exp) return std::exp(staticDouble(x));
+	else if constexpr (isStaticInt<X>) return x < 0 ? negateInt(x) : x;
+	else return std::fabs(staticDouble(x));
+}
+
+// min and max keep Int only when both arguments are Int.
+template <StaticFunction F, typename X, typename Y>
+constexpr auto staticCall(const X& x, const Y& y) {
+	if constexpr (F == StaticFunction::Pow) return std::pow(staticDouble(x), staticDouble(y));
+	else if constexpr (isStaticInt<X> && isStaticInt<Y>) return F == StaticFunction::Min ? std::min(x, y) : std::max(x, y);
+	else if constexpr (F == StaticFunction::Min) return std::min(staticDouble(x), staticDouble(y));
+	else return std::max(staticDouble(x), staticDouble(y));
+}
+
+// An expression parsed at compile time. Call it with one argument per
+// variable, in order of first use; the result is an optional int64_t,
+// double, bool or std::wstring, empty where run() on the interpreter gives
+// Unknown (Int division by zero). Operand type errors are compile errors.
+template <FixedString Source>
+struct StaticExpr {
+	static constexpr StaticTree<Source.size() + 1> tree = parseStatic<Source.size() + 1>(Source.view());
+	static constexpr int variableCount = tree.variableCount;
+
+	static constexpr std::wstring_view variable(int slot) { return tree.variables[slot].text(Source.view()); }
+
+	template <typename... Args>
+	constexpr auto operator()(const Args&... args) const {
+		static_assert(sizeof...(Args) == variableCount, "expected one argument per variable");
+		bool known = true;
+		auto result = evaluate<tree.root>(std::make_tuple(staticValue(args)...), known);
+		using R = std::conditional_t<std::is_same_v<decltype(result), std::wstring_view>, std::wstring, decltype(result)>;
+		return known ? std::optional<R>(R(result)) : std::nullopt;
+	}
+
+	template <typename... Args>
+	Token run(const Args&... args) const {
+		auto result = (*this)(args...);
+		using R = typename decltype(result)::value_type;
+		if (!result) return { TokenKind::Unknown, L"" };
+		if constexpr (std::is_same_v<R, std::wstring>) return { TokenKind::String, *result };
+		else if constexpr (std::is_same_v<R, bool>) return Value::fromBool(*result).toToken();
+		else if constexpr (std::is_same_v<R, int64_t>) return Value::fromInt(*result).toToken();
+		else return Value::fromFloat(*result).toToken();
+	}
+
+private:
+	template <int I, typename Slots>
+	static constexpr auto evaluate(const Slots& slots, bool& known) {
+		constexpr StaticNode node = tree.nodes[I];
+		if constexpr (node.op == TokenKind::Int) return node.i;
+		else if constexpr (node.op == TokenKind::Float) return node.f;
+		else if constexpr (node.op == TokenKind::True) return true;
+		else if constexpr (node.op == TokenKind::False) return false;
+		else if constexpr (node.op == TokenKind::String) return Source.view().substr(node.offset, node.length);
+		else if constexpr (node.op == TokenKind::Variable) return std::get<node.i>(slots);
+		else if constexpr (node.op == TokenKind::Function) {
+			constexpr StaticFunction F = static_cast<StaticFunction>(node.i);
+			if constexpr (node.rhs >= 0) return staticCall<F>(evaluate<node.lhs>(slots, known), evaluate<node.rhs>(slots, known));
+			else return staticCall<F>(evaluate<node.lhs>(slots, known));
+		}
+		else if constexpr (node.op == TokenKind::Negative) {
+			auto x = evaluate<node.lhs>(slots, known);
+			static_assert(isStaticNumber<decltype(x)>, "- needs an Int or Float operand");
+			if constexpr (isStaticInt<decltype(x)>) return negateInt(x);
+			else return -x;
+		}
+		else if constexpr (node.op == TokenKind::Not) return !staticBool(evaluate<node.lhs>(slots, known));
+		else if constexpr (node.op == TokenKind::And) return staticBool(evaluate<node.lhs>(slots, known)) && staticBool(evaluate<node.rhs>(slots, known));
+		else if constexpr (node.op == TokenKind::Or) return staticBool(evaluate<node.lhs>(slots, known)) || staticBool(evaluate<node.rhs>(slots, known));
+		else {
+			auto a = evaluate<node.lhs>(slots, known);
+			auto b = evaluate<node.rhs>(slots, known);
+			using A = decltype(a);
+			using B = decltype(b);
+			if constexpr (node.op == TokenKind::Add && isStaticString<A> && isStaticString<B>) {
+				std::wstring result;
+				result.reserve(a.size() + b.size());
+				result.append(a.begin(), a.end());
+				result.append(b.begin(), b.end());
+				return result;
+			}
+			else if constexpr (node.op == TokenKind::Add) return staticArithmetic(a, b, [](auto x, auto y) { return x + y; });
+			else if constexpr (node.op == TokenKind::Sub) return staticArithmetic(a, b, [](auto x, auto y) { return x - y; });
+			else if constexpr (node.op == TokenKind::Mul) return staticArithmetic(a, b, [](auto x, auto y) { return x * y; });
+			else if constexpr (node.op == TokenKind::Div && isStaticInt<A> && isStaticInt<B>) {
+				if (b == 0) known = false;
+				return b == 0 ? a : divideInt(a, b);
+			}
+			else if constexpr (node.op == TokenKind::Div) return staticArithmetic(a, b, [](auto x, auto y) { return x / y; });
+			else if constexpr (node.op == TokenKind::IsEqual) return staticEquals(a, b);
+			else if constexpr (node.op == TokenKind::IsNotEqual) return !staticEquals(a, b);
+			else if constexpr (node.op == TokenKind::IsGreat) return staticCompare(a, b, [](auto x, auto y) { return x > y; });
+			else if constexpr (node.op == TokenKind::IsLess) return staticCompare(a, b, [](auto x, auto y) { return x < y; });
+			else if constexpr (node.op == TokenKind::IsGreatEqual) return staticCompare(a, b, [](auto x, auto y) { return x >= y; });
+			else return staticCompare(a, b, [](auto x, auto y) { return x <= y; });
+		}
+	}
+};
+
+template <FixedString Source>
+constexpr StaticExpr<Source> compile() {
+	return {};
+}
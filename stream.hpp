@@ -0,0 +1,219 @@
+#pragma once
+#include "parallel.hpp"
+
+#include <charconv>
+#include <cstdio>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define CPP_EVAL_MMAP 1
+#else
+#define CPP_EVAL_MMAP 0
+#endif
+
+// Decodes UTF-8 into out, replacing malformed sequences with U+FFFD. Pure
+// ASCII, the common case for expressions, is a plain widening copy.
+inline void decodeUtf8(std::string_view src, std::wstring& out) {
+	out.clear();
+	for (size_t i = 0; i < src.size();) {
+		unsigned char c = src[i];
+		if (c < 0x80) {
+			out += static_cast<wchar_t>(c);
+			i++;
+			continue;
+		}
+		int length = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 0;
+		char32_t code = length == 4 ? c & 0x07 : length == 3 ? c & 0x0F : c & 0x1F;
+		bool valid = length != 0 && i + length <= src.size();
+		for (int k = 1; valid && k < length; k++) {
+			unsigned char next = src[i + k];
+			valid = (next & 0xC0) == 0x80;
+			code = code << 6 | (next & 0x3F);
+		}
+		if (!valid || code > 0x10FFFF) {
+			out += static_cast<wchar_t>(0xFFFD);
+			i++;
+			continue;
+		}
+		if constexpr (sizeof(wchar_t) == 2) {
+			if (code >= 0x10000) {
+				out += static_cast<wchar_t>(0xD800 + ((code - 0x10000) >> 10));
+				code = 0xDC00 + ((code - 0x10000) & 0x3FF);
+			}
+		}
+		out += static_cast<wchar_t>(code);
+		i += length;
+	}
+}
+
+inline void appendUtf8(std::wstring_view src, std::string& out) {
+	for (size_t i = 0; i < src.size(); i++) {
+		char32_t code = src[i];
+		if constexpr (sizeof(wchar_t) == 2) {
+			if (code >= 0xD800 && code < 0xDC00 && i + 1 < src.size()) code = 0x10000 + ((code - 0xD800) << 10) + (src[++i] - 0xDC00);
+		}
+		if (code < 0x80) out += static_cast<char>(code);
+		else if (code < 0x800) {
+			out += static_cast<char>(0xC0 | code >> 6);
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else if (code < 0x10000) {
+			out += static_cast<char>(0xE0 | code >> 12);
+			out += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+		else {
+			out += static_cast<char>(0xF0 | code >> 18);
+			out += static_cast<char>(0x80 | (code >> 12 & 0x3F));
+			out += static_cast<char>(0x80 | (code >> 6 & 0x3F));
+			out += static_cast<char>(0x80 | (code & 0x3F));
+		}
+	}
+}
+
+// Appends the same `[Kind, "value"]` line Token::print writes.
+inline void appendResult(const Value& v, std::string& out) {
+	out += '[';
+	out += kind2String(v.type);
+	out += ", \"";
+	char buffer[64];
+	switch (v.type) {
+	case TokenKind::Int: out.append(buffer, std::to_chars(buffer, buffer + sizeof(buffer), v.i).ptr); break;
+	case TokenKind::Float: out.append(buffer, std::snprintf(buffer, sizeof(buffer), "%f", v.f)); break;
+	case TokenKind::True: out += "true"; break;
+	case TokenKind::False: out += "false"; break;
+	case TokenKind::String: appendUtf8(*v.s, out); break;
+	default: break;
+	}
+	out += "\"]\n";
+}
+
+struct StreamOptions {
+	size_t chunkBytes = 4 << 20;
+	size_t grain = 64;
+	WorkStealingPool* pool = &WorkStealingPool::shared();
+};
+
+// Evaluates one expression per line of each block handed out by next and
+// writes the results to out in input order. Lines are evaluated in parallel
+// while the previous chunk's output is being written, so memory stays at
+// about one input chunk plus two output chunks.
+template <typename Next>
+inline void evalLines(Next next, std::FILE* out, const StreamOptions& options) {
+	std::vector<std::string_view> lines;
+	std::vector<std::string> pieces[2];
+	std::thread writer;
+	for (int chunk = 0;; chunk++) {
+		std::string_view block = next();
+		if (block.empty()) break;
+		lines.clear();
+		for (size_t start = 0; start < block.size();) {
+			size_t end = block.find('\n', start);
+			if (end == std::string_view::npos) end = block.size();
+			std::string_view line = block.substr(start, end - start);
+			if (!line.empty() && line.back() == '\r') line.remove_suffix(1);
+			lines.push_back(line);
+			start = end + 1;
+		}
+		std::vector<std::string>& output = pieces[chunk % 2];
+		output.resize((lines.size() + options.grain - 1) / options.grain);
+		options.pool->parallelFor(lines.size(), options.grain, [&](size_t begin, size_t end) {
+			thread_local std::wstring src, error;
+			std::string& piece = output[begin / options.grain];
+			piece.clear();
+			std::forward_list<std::wstring> temps;
+			for (size_t i = begin; i < end; i++) {
+				decodeUtf8(lines[i], src);
+				LiteralScope literals;
+				// Lines bind no variables, so one that reads any is Unknown. A
+				// blank line compiles to no code and no error.
+				CompiledExpr expr = compile(src, error);
+				if (!error.empty() || expr.code.empty() || !expr.variables.empty()) {
+					piece += "[Unknown, \"\"]\n";
+					continue;
+				}
+				appendResult(expr.execute(nullptr, temps), piece);
+				temps.clear();
+			}
+		});
+		if (writer.joinable()) writer.join();
+		writer = std::thread([&output, out] {
+			for (const std::string& piece : output) std::fwrite(piece.data(), 1, piece.size(), out);
+		});
+	}
+	if (writer.joinable()) writer.join();
+	std::fflush(out);
+}
+
+// Streams from a FILE such as stdin, carrying a partial last line over to
+// the next chunk.
+inline void evalStream(std::FILE* in, std::FILE* out, const StreamOptions& options = {}) {
+	std::string buffer;
+	size_t consumed = 0;
+	bool eof = false;
+	evalLines([&]() -> std::string_view {
+		buffer.erase(0, consumed);
+		while (!eof) {
+			size_t filled = buffer.size();
+			buffer.resize(filled + options.chunkBytes);
+			size_t n = std::fread(buffer.data() + filled, 1, options.chunkBytes, in);
+			buffer.resize(filled + n);
+			eof = n == 0;
+			size_t end = buffer.rfind('\n');
+			if (end != std::string::npos) {
+				consumed = end + 1;
+				return std::string_view(buffer).substr(0, consumed);
+			}
+		}
+		consumed = buffer.size();
+		return buffer;
+	}, out, options);
+}
+
+// Maps path into memory and evaluates it in chunks that end on a line
+// boundary; pages already evaluated are released back to the kernel.
+// Falls back to evalStream when the file cannot be mapped.
+inline bool evalFile(const char* path, std::FILE* out, const StreamOptions& options = {}) {
+#if CPP_EVAL_MMAP
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return false;
+	struct stat info;
+	if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode)) {
+		size_t size = info.st_size;
+		void* memory = size ? mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0) : nullptr;
+		if (size == 0 || memory != MAP_FAILED) {
+			close(fd);
+			const char* data = static_cast<const char*>(memory);
+			madvise(memory, size, MADV_SEQUENTIAL);
+			size_t offset = 0;
+			size_t released = 0;
+			long page = sysconf(_SC_PAGESIZE);
+			evalLines([&]() -> std::string_view {
+				size_t start = offset;
+				size_t done = start & ~(page - 1);
+				if (done > released) {
+					madvise(const_cast<char*>(data) + released, done - released, MADV_DONTNEED);
+					released = done;
+				}
+				if (start >= size) return {};
+				size_t end = std::min(size, start + options.chunkBytes);
+				while (end < size && data[end - 1] != '\n') end++;
+				offset = end;
+				return std::string_view(data + start, end - start);
+			}, out, options);
+			if (size) munmap(memory, size);
+			return true;
+		}
+	}
+	close(fd);
+#endif
+	std::FILE* in = std::fopen(path, "rb");
+	if (!in) return false;
+	evalStream(in, out, options);
+	std::fclose(in);
+	return true;
+}
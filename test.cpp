@@ -0,0 +1,347 @@
+#include "cache.hpp"
+#include "exprset.hpp"
+#include "jit.hpp"
+#include "static.hpp"
+#include "stream.hpp"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+
+// Checks every evaluation path against CompiledExpr::run on the same inputs,
+// plus inputs that used to crash. Independent of NDEBUG, so it also covers
+// the Release build.
+
+static int failures = 0;
+
+#define CHECK(condition, what) \
+	do { \
+		if (!(condition)) { \
+			failures++; \
+			std::wcout << __FILE__ << L":" << __LINE__ << L": " << what << L"\n"; \
+		} \
+	} while (false)
+
+static bool same(const Token& a, const Token& b) {
+	return a.type == b.type && a.data == b.data;
+}
+
+static std::wstring show(const Token& t) {
+	const char* kind = kind2String(t.type);
+	return L"[" + std::wstring(kind, kind + std::strlen(kind)) + L", \"" + t.data + L"\"]";
+}
+
+static const std::vector<std::wstring> corpus = {
+	L"x + y * 2 - 1", L"x / y", L"-x + 3", L"x * x - y", L"(x + 1) * (y - 1) / 3", L"1 + 2 * 3 + x",
+	L"x > y", L"x <= 2.5", L"x == y", L"x != 1", L"2 < x", L"x >= -1",
+	L"x > 0 and y > 0", L"x < 0 or y < 0", L"not (x > y)", L"x > 1 and x < 3 or y == 2", L"y == 0 or x / y > 1",
+	L"min(x, 3) / 2", L"max(x, y) + 1", L"pow(x, 2) + y", L"abs(x - y)", L"sqrt(abs(x))", L"sin(x) * cos(y)", L"exp(-y) * x",
+};
+
+// Slots for one record; ints picks Int values, otherwise Floats.
+static std::vector<Value> record(std::mt19937& rng, bool intX, bool intY) {
+	std::uniform_int_distribution<int> pick(-4, 4);
+	std::uniform_real_distribution<double> real(-4, 4);
+	auto make = [&](bool integer) { return integer ? Value::fromInt(pick(rng)) : Value::fromFloat(rng() % 4 ? real(rng) : pick(rng)); };
+	Value x = make(intX);
+	return { x, make(intY) };
+}
+
+static std::map<std::wstring, Value> bindings(const std::vector<Value>& slots) {
+	return { { L"x", slots[0] }, { L"y", slots[1] } };
+}
+
+static std::vector<Value> slotsFor(const CompiledExpr& expr, const std::map<std::wstring, Value>& named) {
+	std::vector<Value> slots;
+	for (const std::wstring& name : expr.variables) slots.push_back(named.at(name));
+	return slots;
+}
+
+static void testPaths() {
+	std::mt19937 rng(7);
+	ExprSet set = compileSet(corpus);
+	ReactiveSet live(set);
+	int native = 0;
+	for (int round = 0; round < 4; round++) {
+		bool intX = round & 1, intY = round & 2;
+		std::map<std::wstring, TokenKind> types = { { L"x", intX ? TokenKind::Int : TokenKind::Float }, { L"y", intY ? TokenKind::Int : TokenKind::Float } };
+		for (int r = 0; r < 50; r++) {
+			std::vector<Value> slots = record(rng, intX, intY);
+			std::map<std::wstring, Value> named = bindings(slots);
+			std::vector<Token> fromSet = set.run(named);
+			live.set(L"x", slots[0]);
+			live.set(L"y", slots[1]);
+			std::vector<Token> fromLive = live.run();
+			for (int i = 0; i < corpus.size(); i++) {
+				CompiledExpr expr = compile(corpus[i]);
+				Token expected = expr.run(named);
+				std::wstring error;
+				CompiledExpr typed = compile(corpus[i], types, error);
+				CHECK(error.empty(), corpus[i] << L": " << error);
+				Token got = typed.run(named);
+				CHECK(same(got, expected), corpus[i] << L" typed " << show(got) << L" != " << show(expected));
+				CHECK(same(fromSet[i], expected), corpus[i] << L" ExprSet " << show(fromSet[i]) << L" != " << show(expected));
+				CHECK(same(fromLive[i], expected), corpus[i] << L" ReactiveSet " << show(fromLive[i]) << L" != " << show(expected));
+				if (!intX && !intY) {
+					if (auto code = jitCompile(typed)) {
+						Token got = code->call(slotsFor(typed, named).data()).toToken();
+						CHECK(same(got, expected), corpus[i] << L" JIT " << show(got) << L" != " << show(expected));
+						native++;
+					}
+				}
+			}
+		}
+	}
+#if CPP_EVAL_JIT
+	CHECK(native > 0, L"nothing was compiled to native code");
+#endif
+}
+
+static void testHotExpr() {
+	std::wstring error;
+	HotExpr hot(compile(L"x * 2 + 1 > y", { { L"x", TokenKind::Float }, { L"y", TokenKind::Float } }, error), 3);
+	std::map<std::wstring, Value> named = { { L"x", Value::fromFloat(1.5) }, { L"y", Value::fromFloat(3) } };
+	for (int run = 1; run <= 5; run++) {
+		CHECK(same(hot.run(named), { TokenKind::True, L"true" }), L"HotExpr run " << run);
+		CHECK(hot.promoted() == (CPP_EVAL_JIT && run >= 3), L"HotExpr promoted after run " << run);
+	}
+	HotExpr strings(compile(L"s + \"!\"", { { L"s", TokenKind::String } }, error), 1);
+	CHECK(same(strings.run({ { L"s", Value::fromInterned(intern(L"a")) } }), { TokenKind::String, L"a!" }), L"HotExpr String fallback");
+	CHECK(!strings.promoted(), L"String expression promoted");
+}
+
+// runBatch reads undeclared variables as Float, so it is compared with run()
+// on Float slots, with Bool results as 1 and 0.
+static void testBatch() {
+	std::mt19937 rng(11);
+	const int rows = 600;
+	std::vector<double> xs(rows), ys(rows), out(rows);
+	for (int k = 0; k < rows; k++) {
+		std::vector<Value> slots = record(rng, false, false);
+		xs[k] = slots[0].f;
+		ys[k] = slots[1].f;
+	}
+	for (const std::wstring& src : corpus) {
+		CompiledExpr expr = compile(src);
+		std::vector<std::span<const double>> columns;
+		for (const std::wstring& name : expr.variables) columns.push_back(name == L"x" ? std::span<const double>(xs) : std::span<const double>(ys));
+		CHECK(expr.runBatch(columns, out), src << L" runBatch failed");
+		std::forward_list<std::wstring> temps;
+		for (int k = 0; k < rows; k++) {
+			std::map<std::wstring, Value> named = { { L"x", Value::fromFloat(xs[k]) }, { L"y", Value::fromFloat(ys[k]) } };
+			Value v = expr.execute(slotsFor(expr, named).data(), temps);
+			double want = isBool(v) ? (v.type == TokenKind::True ? 1.0 : 0.0) : toDouble(v);
+			bool equal = want == out[k] || (std::isnan(want) && std::isnan(out[k]));
+			CHECK(equal, src << L" runBatch row " << k << L": " << out[k] << L" != " << want);
+			if (!equal) break;
+		}
+	}
+	// The type of a Value-returning call can differ per row: Int division
+	// for min(5, 3), Float for min(2.5, 3).
+	CompiledExpr mixed = compile(L"min(x, 3) / 2");
+	std::vector<double> values = { 5, 2.5, 7, 1.5 }, results(values.size());
+	std::vector<std::span<const double>> column = { values };
+	mixed.runBatch(column, results);
+	CHECK(results[0] == 1 && results[1] == 1.25 && results[2] == 1 && results[3] == 0.75, L"min(x, 3) / 2 runBatch mixes row types");
+	std::wstring error;
+	CompiledExpr typed = compile(L"x / 2", { { L"x", TokenKind::Int } }, error);
+	CHECK(typed.runBatch(column, results) && results[0] == 2 && results[2] == 3, L"declared Int column runBatch");
+
+	CHECK(!compile(L"").runBatch(column, results), L"empty program runBatch");
+	CHECK(!compile(L"\"a\"").runBatch(column, results), L"String runBatch");
+	CHECK(!compile(L"x and true").runBatch(column, results), L"Float and runBatch");
+}
+
+static void testIntegers() {
+	std::wstring error;
+	CHECK(compile(L"99999999999999999999", error).code.empty() && !error.empty(), L"out-of-range Int literal");
+	CHECK(same(eval(L"9223372036854775807"), { TokenKind::Int, L"9223372036854775807" }), L"INT64_MAX literal");
+	CHECK(same(eval(L"9223372036854775807 + 1"), { TokenKind::Int, L"-9223372036854775808" }), L"Int add wraps");
+	CHECK(same(eval(L"(0 - 9223372036854775807 - 1) * -1"), { TokenKind::Int, L"-9223372036854775808" }), L"Int mul wraps");
+	CHECK(same(eval(L"-(0 - 9223372036854775807 - 1)"), { TokenKind::Int, L"-9223372036854775808" }), L"Int negate wraps");
+}
+
+static void testUnbound() {
+	for (const wchar_t* src : { L"x + 1", L"not (x > 1)", L"x > 1 and y", L"-x == 1" }) {
+		CHECK(same(compile(src).run(), { TokenKind::Unknown, L"" }), src << L" with x unbound");
+	}
+}
+
+static void testIdentities() {
+	// Kept unless the operand is known to be a number, or a Bool for not.
+	for (const wchar_t* src : { L"x + 0", L"0 + x", L"x - 0", L"x * 1", L"1 * x", L"x / 1", L"- -x", L"not not x", L"x and true", L"false or x" }) {
+		CHECK(compile(src).program.size() > 1, src << L" simplified");
+	}
+	for (const wchar_t* src : { L"(x > 1) and true", L"not not (x > 1)", L"-(-(x + 0.5))", L"(x * 2.5) / 1" }) {
+		CHECK(compile(src).program.size() == 3, src << L" not simplified");
+	}
+	std::wstring error;
+	CHECK(compile(L"not not 5", error).code.empty() && !error.empty(), L"not not 5");
+	CHECK(compile(L"s - 0", { { L"s", TokenKind::String } }, error).code.empty(), L"typed s - 0");
+	CHECK(compile(L"b * 1", { { L"b", TokenKind::True } }, error).code.empty(), L"typed b * 1");
+}
+
+static void testArguments() {
+	registerFunction<int64_t(const std::wstring&)>(L"len", [](const std::wstring& s) { return static_cast<int64_t>(s.size()); });
+	for (const wchar_t* src : { L"len(5)", L"sin(\"a\")", L"min(\"a\", 1)", L"abs(true)" }) {
+		CHECK(same(eval(src), { TokenKind::Unknown, L"" }), src);
+	}
+	std::map<std::wstring, Value> text = { { L"x", Value::fromInterned(intern(L"ab")) } };
+	for (const wchar_t* src : { L"min(x, 1)", L"abs(x)", L"sqrt(x)" }) {
+		CHECK(same(compile(src).run(text), { TokenKind::Unknown, L"" }), src << L" with a String x");
+	}
+	CHECK(same(compile(L"len(x) + 1").run(text), { TokenKind::Int, L"3" }), L"len(x) + 1");
+}
+
+static void testMalformed() {
+	for (const wchar_t* src : { L"1 +", L")", L"(1", L"pow(1)", L"foo(1)", L"x y", L"1 2", L"\"abc", L"1 = 2", L"()" }) {
+		std::wstring error;
+		CompiledExpr expr = compile(src, error);
+		CHECK(expr.code.empty() && !error.empty(), src << L" should not compile");
+		CHECK(same(expr.run(), { TokenKind::Unknown, L"" }), src << L" should run as Unknown");
+		ExprCache cache;
+		CHECK(cache.get(src)->code.empty(), src << L" cached");
+	}
+	// Names of registered functions are variables outside call position.
+	CompiledExpr max = compile(L"max - 1");
+	CHECK(same(max.run({ { L"max", Value::fromInt(5) } }), { TokenKind::Int, L"4" }), L"max - 1");
+	CompiledExpr min = compile(L"x > min");
+	CHECK(same(min.run({ { L"x", Value::fromInt(2) }, { L"min", Value::fromInt(1) } }), { TokenKind::True, L"true" }), L"x > min");
+	CHECK(same(eval(L"sin 0"), { TokenKind::Float, L"0.000000" }), L"sin 0");
+}
+
+static void testDivision() {
+	CHECK(same(eval(L"1 / 0"), { TokenKind::Unknown, L"" }), L"1 / 0");
+	CHECK(same(eval(L"7 / -2"), { TokenKind::Int, L"-3" }), L"7 / -2");
+	CHECK(same(eval(L"(0 - 9223372036854775807 - 1) / -1"), { TokenKind::Int, L"-9223372036854775808" }), L"INT64_MIN / -1");
+	std::map<std::wstring, Value> zero = { { L"x", Value::fromInt(1) }, { L"y", Value::fromInt(0) } };
+	CHECK(same(compile(L"x / y + 1").run(zero), { TokenKind::Unknown, L"" }), L"x / y + 1");
+	std::wstring error;
+	CompiledExpr typed = compile(L"x / y", { { L"x", TokenKind::Int }, { L"y", TokenKind::Int } }, error);
+	CHECK(same(typed.run(zero), { TokenKind::Unknown, L"" }), L"typed x / y");
+	std::vector<std::wstring> sources = { L"x / y + 1", L"y == 0 or x / y > 1" };
+	std::vector<Token> results = compileSet(sources).run(zero);
+	CHECK(same(results[0], { TokenKind::Unknown, L"" }) && same(results[1], { TokenKind::True, L"true" }), L"ExprSet x / y");
+}
+
+static std::wstring orChain(int clauses) {
+	std::wstring src;
+	for (int i = 0; i < clauses; i++) src += (i ? L" or x == " : L"x == ") + std::to_wstring(i);
+	return src;
+}
+
+static void testLarge() {
+	// More constants than a register can address.
+	CompiledExpr chain = compile(orChain(16400));
+	for (int64_t x : { 0, 16383, 16384, 16399, 16400 }) {
+		Token expected = { x < 16400 ? TokenKind::True : TokenKind::False, x < 16400 ? L"true" : L"false" };
+		CHECK(same(chain.run({ { L"x", Value::fromInt(x) } }), expected), L"16400-clause chain at " << x);
+	}
+	std::wstring sum;
+	for (int i = 0; i < 16400; i++) sum += (i ? L" + v" : L"v") + std::to_wstring(i);
+	std::vector<Value> slots(16400, Value::fromInt(1));
+	CHECK(same(compile(sum).run(slots), { TokenKind::Int, L"16400" }), L"16400 variables");
+	std::wstring deep;
+	for (int i = 0; i < 17000; i++) deep += L"x + (";
+	deep += L"x" + std::wstring(17000, L')');
+	std::wstring error;
+	CHECK(compile(deep, error).code.empty() && !error.empty(), L"too many temporaries");
+
+	std::vector<std::wstring> sources = { orChain(50000) };
+	ExprSet set = compileSet(sources);
+	CHECK(same(set.run({ { L"x", Value::fromInt(49999) } })[0], { TokenKind::True, L"true" }), L"50000-clause ExprSet");
+	ReactiveSet live(set);
+	live.set(L"x", Value::fromInt(50000));
+	CHECK(live.value(0).type == TokenKind::False, L"50000-clause ReactiveSet");
+}
+
+static void testStream() {
+	std::string input = "1 +\n)\n(1\npow(1)\nmax - 1\n1 / 0\n\"a\" - 1\n\n \t\nmin(\"a\", 1)\n7 / 2\n\"a\" + \"b\"\n";
+	std::string expected;
+	for (int i = 0; i < 10; i++) expected += "[Unknown, \"\"]\n";
+	expected += "[Int, \"3\"]\n[String, \"ab\"]\n";
+	std::FILE* out = std::tmpfile();
+	bool given = false;
+	evalLines([&]() -> std::string_view {
+		if (given) return {};
+		given = true;
+		return input;
+	}, out, {});
+	std::rewind(out);
+	std::string got;
+	char buffer[256];
+	for (size_t n; (n = std::fread(buffer, 1, sizeof(buffer), out)) > 0;) got.append(buffer, n);
+	std::fclose(out);
+	CHECK(got == expected, L"evalLines output");
+}
+
+static void testStrings() {
+	CompiledExpr chain = compile(L"x + \"b\" + x + \"d\" + x");
+	CHECK(same(chain.run({ { L"x", Value::fromInterned(intern(L"a")) } }), { TokenKind::String, L"abada" }), L"String chain");
+	CompiledExpr equal = compile(L"x == \"ab\"");
+	std::wstring copy = L"ab";
+	CHECK(same(equal.run({ { L"x", Value::fromString(&copy) } }), { TokenKind::True, L"true" }), L"== with a String not interned");
+	CHECK(same(equal.run({ { L"x", Value::fromInterned(intern(L"ab")) } }), { TokenKind::True, L"true" }), L"== between interned Strings");
+	CHECK(same(equal.run({ { L"x", Value::fromInterned(intern(L"ac")) } }), { TokenKind::False, L"false" }), L"!= between interned Strings");
+}
+
+static void testCache() {
+	ExprCache cache(1 << 12, 1);
+	std::shared_ptr<const CompiledExpr> kept = cache.get(L"x + \"!\"");
+	for (int i = 0; i < 200; i++) cache.get(L"\"" + std::to_wstring(i) + L"\" + x");
+	CHECK(cache.stats().evictions > 0, L"nothing evicted");
+	// Literals belong to the entry rather than to the global intern pool.
+	const std::wstring* interned = intern(L"!");
+	CHECK(std::none_of(kept->program.begin(), kept->program.end(), [&](const Instr& instr) { return instr.op == TokenKind::String && instr.value.s == interned; }), L"cached literal interned");
+	CHECK(same(kept->run({ { L"x", Value::fromInterned(intern(L"a")) } }), { TokenKind::String, L"a!" }), L"evicted entry still runs");
+}
+
+static void testStatic() {
+	static_assert(compile<"x * 2 + 1">()(3) == 7);
+	constexpr auto divide = compile<"a / b">();
+	CHECK(same(divide.run(1, 0), { TokenKind::Unknown, L"" }), L"static 1 / 0");
+	CHECK(same(divide.run(INT64_MIN, -1), { TokenKind::Int, L"-9223372036854775808" }), L"static INT64_MIN / -1");
+	CHECK(same(divide.run(7, -2), eval(L"7 / -2")), L"static 7 / -2");
+	CHECK(same(divide.run(1.0, 0), eval(L"1.0 / 0")), L"static 1.0 / 0");
+	CHECK(same(compile<"a + 1">().run(INT64_MAX), eval(L"9223372036854775807 + 1")), L"static Int add wraps");
+	CHECK(same(compile<"max - 1">().run(5), { TokenKind::Int, L"4" }), L"static max - 1");
+	CHECK(same(compile<"max(a, 2) - min(a, 2)">().run(5), { TokenKind::Int, L"3" }), L"static max(a, 2) - min(a, 2)");
+	CHECK(compile<"0.1234567890123456789">()() == std::wcstod(L"0.1234567890123456789", nullptr), L"static Float literal rounding");
+	CHECK(compile<"9007199254740993.0">()() == std::wcstod(L"9007199254740993.0", nullptr), L"static Float literal tie");
+}
+
+#if CPP_EVAL_PROFILE
+static void testProfile() {
+	profileReset();
+	compile(L"(1 + 2) * 3 + x").run({ { L"x", Value::fromInt(1) } });
+	ProfileReport report = profileReport();
+	CHECK(report.ops[static_cast<int>(OpCode::Return)] == 1, L"constant folding counted as executed opcodes");
+}
+#endif
+
+int main() {
+	testPaths();
+	testHotExpr();
+	testBatch();
+	testIntegers();
+	testUnbound();
+	testIdentities();
+	testArguments();
+	testMalformed();
+	testDivision();
+	testLarge();
+	testStream();
+	testStrings();
+	testCache();
+	testStatic();
+#if CPP_EVAL_PROFILE
+	testProfile();
+#endif
+	if (failures) {
+		std::wcout << failures << L" failed\n";
+		return 1;
+	}
+	std::wcout << L"all passed\n";
+	return 0;
+}